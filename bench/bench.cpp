@@ -0,0 +1,519 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+
+#include "scenes.h"
+
+// Fixed-seed microbenchmarks for the intersection and shading kernels, plus an end-to-end
+// render of every scene in the catalog. Results go to stdout (or --out <file>) as JSON;
+// progress goes to std::clog.
+//
+//   RayTracingBench [--filter <substring>] [--out <file>] [--threads <n>]
+//                   [--width <pixels>] [--spp <samples>] [--trials <n>]
+
+namespace
+{
+    const unsigned int bench_seed = 20240601;
+
+    struct bench_options
+    {
+        std::string filter;        // 只运行名称包含该子串的基准
+        std::string out;           // JSON 输出文件（为空时写到标准输出）
+        int threads = 1;           // 端到端渲染的线程数（1 时结果可复现）
+        int image_width = 160;     // 端到端渲染的图像宽度
+        int samples_per_pixel = 8; // 端到端渲染的每像素采样数
+        int trials = 7;            // 每个基准的重复次数
+    };
+
+    struct micro_result
+    {
+        std::string name;
+        double ns_per_op;     // Median over the trials
+        double min_ns_per_op; // Fastest trial
+        size_t ops;           // Operations per trial
+        double checksum;      // Folded from the kernel's results, so it cannot be optimized away
+    };
+
+    struct scene_result
+    {
+        std::string name;
+        int width, height, samples_per_pixel, max_depth;
+        double seconds;
+        double samples_per_second;
+        std::uint64_t rays; // Zero unless built with RAYTRACING_STATS
+    };
+
+    volatile double sink;
+
+    template <typename Kernel>
+    micro_result run_micro(const std::string &name, size_t ops, int trials, Kernel kernel)
+    {
+        // kernel() performs ops operations and returns a checksum. One untimed warm-up run,
+        // then the median and the best of the timed trials.
+        micro_result result{name, 0, 0, ops, kernel()};
+        std::vector<double> times;
+        for (int trial = 0; trial < trials; trial++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            sink = kernel();
+            auto end = std::chrono::steady_clock::now();
+            times.push_back(std::chrono::duration<double, std::nano>(end - start).count() / ops);
+        }
+        std::sort(times.begin(), times.end());
+        result.ns_per_op = times[times.size() / 2];
+        result.min_ns_per_op = times.front();
+        std::clog << name << ": " << result.ns_per_op << " ns/op\n";
+        return result;
+    }
+
+    std::vector<ray> random_rays(size_t count, double origin_distance, double target_extent)
+    {
+        // Rays from a sphere of radius origin_distance around the origin towards points in a
+        // cube of half-width target_extent, so unit-sized primitives are hit about half the time.
+        std::vector<ray> rays;
+        rays.reserve(count);
+        for (size_t n = 0; n < count; n++)
+        {
+            auto origin = origin_distance * random_unit_vector();
+            auto target = point3::random(-target_extent, target_extent);
+            rays.emplace_back(origin, target - origin, random_double());
+        }
+        return rays;
+    }
+
+    template <typename Primitive>
+    double hit_kernel(const Primitive &primitive, const std::vector<ray> &rays, int passes)
+    {
+        double checksum = 0;
+        hit_record rec;
+        for (int pass = 0; pass < passes; pass++)
+            for (const auto &r : rays)
+                if (primitive.hit(r, interval(0.001, infinity), rec))
+                    checksum += rec.t;
+        return checksum;
+    }
+
+    std::vector<hit_record> surface_hits(const hittable &target, const std::vector<ray> &rays)
+    {
+        std::vector<hit_record> hits;
+        hit_record rec;
+        for (const auto &r : rays)
+            if (target.hit(r, interval(0.001, infinity), rec))
+                hits.push_back(rec);
+        return hits;
+    }
+
+    double scatter_kernel(const material &mat, const std::vector<ray> &rays, const std::vector<hit_record> &hits,
+                          int passes)
+    {
+        double checksum = 0;
+        color attenuation;
+        ray scattered;
+        double pdf;
+        for (int pass = 0; pass < passes; pass++)
+            for (size_t n = 0; n < hits.size(); n++)
+                if (mat.scatter(rays[n], hits[n], attenuation, scattered, pdf))
+                    checksum += scattered.direction().x + attenuation.x;
+        return checksum;
+    }
+
+    vec3 rejection_in_unit_sphere()
+    {
+        // The rejection samplers vec.cpp used before, kept as a baseline.
+        while (true)
+        {
+            auto p = vec3::random(-1, 1);
+            if (p.length_squared() < 1)
+                return p;
+        }
+    }
+
+    vec3 rejection_in_unit_disk()
+    {
+        while (true)
+        {
+            auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+            if (p.length_squared() < 1)
+                return p;
+        }
+    }
+
+    template <typename Generate>
+    double vector_kernel(std::vector<vec3> &out, int passes, Generate generate)
+    {
+        double checksum = 0;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (auto &v : out)
+                v = generate();
+            checksum += out[pass % out.size()].x;
+        }
+        return checksum;
+    }
+
+    template <typename Fill>
+    double batch_kernel(std::vector<vec3> &out, int passes, Fill fill)
+    {
+        double checksum = 0;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            fill(out.data(), out.size());
+            checksum += out[pass % out.size()].x;
+        }
+        return checksum;
+    }
+
+    std::vector<micro_result> run_micro_benchmarks(const bench_options &options)
+    {
+        std::vector<micro_result> results;
+        auto selected = [&](const char *name)
+        { return options.filter.empty() || std::strstr(name, options.filter.c_str()) != nullptr; };
+
+        const size_t ray_count = 4096;
+        const int passes = 256;
+        auto ops = ray_count * passes;
+
+        seed_random(bench_seed);
+        auto rays = random_rays(ray_count, 3, 1.5);
+        auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+        if (selected("sphere_hit"))
+        {
+            sphere s(point3(0, 0, 0), 1, mat);
+            results.push_back(run_micro("sphere_hit", ops, options.trials,
+                                        [&]
+                                        { return hit_kernel(s, rays, passes); }));
+        }
+
+        if (selected("quad_hit"))
+        {
+            quad q(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat);
+            results.push_back(run_micro("quad_hit", ops, options.trials,
+                                        [&]
+                                        { return hit_kernel(q, rays, passes); }));
+        }
+
+        if (selected("aabb_hit"))
+        {
+            aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+            results.push_back(run_micro("aabb_hit", ops, options.trials,
+                                        [&]
+                                        {
+                                            double checksum = 0;
+                                            for (int pass = 0; pass < passes; pass++)
+                                                for (const auto &r : rays)
+                                                    checksum += box.hit(r, interval(0.001, infinity));
+                                            return checksum;
+                                        }));
+        }
+
+        if (selected("bvh_hit"))
+        {
+            // Rays from the random spheres camera position into the field of small spheres.
+            seed_random(bench_seed);
+            bvh_node tree(random_spheres_world());
+            std::vector<ray> scene_rays;
+            point3 origin(13, 2, 3);
+            for (size_t n = 0; n < ray_count; n++)
+                scene_rays.emplace_back(origin, point3(random_double(-11, 11), random_double(0, 1),
+                                                       random_double(-11, 11)) - origin, random_double());
+            results.push_back(run_micro("bvh_hit", ray_count * (passes / 8), options.trials,
+                                        [&]
+                                        { return hit_kernel(tree, scene_rays, passes / 8); }));
+        }
+
+        if (selected("medium_sphere_hit") || selected("medium_box_hit"))
+        {
+            // Fog inside a sphere (as around final_scene) and inside a rotated box (as in
+            // cornell_smoke): each hit finds where the ray enters and leaves the boundary.
+            auto fog_sphere = make_shared<sphere>(point3(0, 0, 0), 1, mat);
+            shared_ptr<hittable> fog_box = box(point3(-1, -1, -1), point3(1, 1, 1), mat);
+            fog_box = make_shared<translate>(make_shared<rotate_y>(fog_box, 15), vec3(0, 0, 0));
+            const std::pair<const char *, shared_ptr<hittable>> boundaries[] = {{"medium_sphere_hit", fog_sphere},
+                                                                                {"medium_box_hit", fog_box}};
+            for (const auto &[name, boundary] : boundaries)
+            {
+                if (!selected(name))
+                    continue;
+                constant_medium fog(boundary, 0.5, color(1, 1, 1));
+                seed_random(bench_seed);
+                results.push_back(run_micro(name, ray_count * (passes / 8), options.trials,
+                                            [&] { return hit_kernel(fog, rays, passes / 8); }));
+            }
+        }
+
+        if (selected("perlin_noise") || selected("perlin_turb") || selected("perlin_turb_batch"))
+        {
+            seed_random(bench_seed);
+            perlin noise;
+            std::vector<point3> points(ray_count);
+            for (auto &p : points)
+                p = point3::random(0, 16);
+            std::vector<double> values(points.size());
+
+            if (selected("perlin_noise"))
+                results.push_back(run_micro("perlin_noise", ops, options.trials,
+                                            [&]
+                                            {
+                                                double checksum = 0;
+                                                for (int pass = 0; pass < passes; pass++)
+                                                    for (const auto &p : points)
+                                                        checksum += noise.noise(p);
+                                                return checksum;
+                                            }));
+
+            if (selected("perlin_turb"))
+                results.push_back(run_micro("perlin_turb", ray_count * (passes / 8), options.trials,
+                                            [&]
+                                            {
+                                                double checksum = 0;
+                                                for (int pass = 0; pass < passes / 8; pass++)
+                                                    for (const auto &p : points)
+                                                        checksum += noise.turb(p);
+                                                return checksum;
+                                            }));
+
+            if (selected("perlin_turb_batch"))
+                results.push_back(run_micro("perlin_turb_batch", ray_count * (passes / 8), options.trials,
+                                            [&]
+                                            {
+                                                double checksum = 0;
+                                                for (int pass = 0; pass < passes / 8; pass++)
+                                                {
+                                                    noise.turb(points.data(), values.data(), points.size());
+                                                    checksum += values[pass % values.size()];
+                                                }
+                                                return checksum;
+                                            }));
+        }
+
+        {
+            // Point and direction generators: the old rejection loops, the closed-form scalar
+            // functions, and the batch forms.
+            std::vector<vec3> points(ray_count);
+            auto vector_passes = passes / 4;
+            auto vector_ops = ray_count * vector_passes;
+            auto add_scalar = [&](const char *name, vec3 (*generate)())
+            {
+                if (!selected(name))
+                    return;
+                seed_random(bench_seed);
+                results.push_back(run_micro(name, vector_ops, options.trials,
+                                            [&] { return vector_kernel(points, vector_passes, generate); }));
+            };
+            auto add_batch = [&](const char *name, void (*fill)(vec3 *, size_t))
+            {
+                if (!selected(name))
+                    return;
+                seed_random(bench_seed);
+                results.push_back(run_micro(name, vector_ops, options.trials,
+                                            [&] { return batch_kernel(points, vector_passes, fill); }));
+            };
+
+            add_scalar("in_unit_sphere_rejection", rejection_in_unit_sphere);
+            add_scalar("in_unit_sphere", random_in_unit_sphere);
+            add_batch("in_unit_sphere_batch", random_in_unit_sphere);
+            add_scalar("in_unit_disk_rejection", rejection_in_unit_disk);
+            add_scalar("in_unit_disk", random_in_unit_disk);
+            add_batch("in_unit_disk_batch", random_in_unit_disk);
+            add_scalar("unit_vector_rejection", [] { return rejection_in_unit_sphere().normalize(); });
+            add_scalar("unit_vector", random_unit_vector);
+            add_batch("unit_vector_batch", random_unit_vector);
+        }
+
+        if (selected("scatter_lambertian") || selected("scatter_metal") || selected("scatter_dielectric"))
+        {
+            // Scatter the rays that hit a unit sphere, with each material in turn.
+            sphere s(point3(0, 0, 0), 1, mat);
+            std::vector<ray> hitting;
+            for (const auto &r : rays)
+            {
+                hit_record rec;
+                if (s.hit(r, interval(0.001, infinity), rec))
+                    hitting.push_back(r);
+            }
+            auto hits = surface_hits(s, hitting);
+            auto scatter_ops = hits.size() * passes;
+
+            lambertian diffuse(color(0.5, 0.5, 0.5));
+            metal shiny(color(0.8, 0.8, 0.9), 0.3);
+            dielectric glass(1.5);
+            const std::pair<const char *, const material *> materials[] = {
+                {"scatter_lambertian", &diffuse}, {"scatter_metal", &shiny}, {"scatter_dielectric", &glass}};
+
+            for (const auto &[name, m] : materials)
+            {
+                if (!selected(name))
+                    continue;
+                seed_random(bench_seed);
+                results.push_back(run_micro(name, scatter_ops, options.trials,
+                                            [&]
+                                            { return scatter_kernel(*m, hitting, hits, passes); }));
+            }
+        }
+
+        for (size_t light_count : {1024, 16384})
+        {
+            // Picking one of many small lamps from the ray origins, by each selection strategy.
+            const std::pair<const char *, light_selection> strategies[] = {
+                {"light_select_uniform", light_selection::uniform},
+                {"light_select_power", light_selection::power},
+                {"light_select_bvh", light_selection::bvh}};
+            auto suffix = "_" + std::to_string(light_count / 1024) + "k";
+
+            std::vector<shared_ptr<hittable>> lamps;
+            std::vector<const hittable *> emitters;
+            seed_random(bench_seed);
+            for (size_t i = 0; i < light_count; i++)
+            {
+                auto glow = make_shared<diffuse_light>(color::random(0.2, 1));
+                lamps.push_back(make_shared<sphere>(vec3::random(-20, 20), 0.05, glow));
+                emitters.push_back(lamps.back().get());
+            }
+
+            for (const auto &[base, type] : strategies)
+            {
+                auto name = base + suffix;
+                if (!selected(name.c_str()))
+                    continue;
+                auto selector = make_light_selector(type, emitters);
+                seed_random(bench_seed);
+                results.push_back(run_micro(name, ray_count * (passes / 8), options.trials,
+                                            [&]
+                                            {
+                                                double sum = 0, pmf;
+                                                for (int pass = 0; pass < passes / 8; pass++)
+                                                    for (const auto &r : rays)
+                                                        if (selector->sample(r.origin(), random_double(), pmf))
+                                                            sum += pmf;
+                                                return sum;
+                                            }));
+            }
+        }
+
+        return results;
+    }
+
+    std::vector<scene_result> run_scene_benchmarks(const bench_options &options)
+    {
+        // Every catalog scene at a reduced size, rendered to a discarded stream. Scene
+        // construction (and any texture loading) is not timed.
+        std::vector<scene_result> results;
+        for (const auto &entry : scene_catalog())
+        {
+            auto name = std::string("scene_") + entry.name;
+            if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+                continue;
+
+            seed_random(bench_seed);
+            auto s = entry.build();
+            s.cam.image_width = options.image_width;
+            s.cam.samples_per_pixel = options.samples_per_pixel;
+            s.cam.thread_count = options.threads;
+            s.cam.show_progress = false;
+
+            std::ofstream discard;
+            auto start = std::chrono::steady_clock::now();
+            s.cam.render(s.world, discard);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            auto height = std::max(1, static_cast<int>(s.cam.image_width / s.cam.aspect_ratio));
+            auto samples = static_cast<double>(s.cam.image_width) * height * s.cam.samples_per_pixel;
+            results.push_back({name, s.cam.image_width, height, s.cam.samples_per_pixel, s.cam.max_depth, seconds,
+                               samples / seconds, s.cam.stats.rays});
+            std::clog << name << ": " << seconds << " s, " << samples / seconds << " samples/s\n";
+        }
+        return results;
+    }
+
+    void write_json(std::ostream &out, const bench_options &options, const std::vector<micro_result> &micro,
+                    const std::vector<scene_result> &scenes)
+    {
+        out << "{\n"
+            << "  \"seed\": " << bench_seed << ",\n"
+            << "  \"stats\": " << (stats_enabled ? "true" : "false") << ",\n"
+            << "  \"threads\": " << options.threads << ",\n"
+            << "  \"trials\": " << options.trials << ",\n"
+            << "  \"micro\": [";
+        for (size_t n = 0; n < micro.size(); n++)
+        {
+            const auto &m = micro[n];
+            out << (n ? ",\n" : "\n") << "    {\"name\": \"" << m.name << "\", \"ns_per_op\": " << m.ns_per_op
+                << ", \"min_ns_per_op\": " << m.min_ns_per_op << ", \"ops\": " << m.ops
+                << ", \"checksum\": " << m.checksum << "}";
+        }
+        out << "\n  ],\n"
+            << "  \"scenes\": [";
+        for (size_t n = 0; n < scenes.size(); n++)
+        {
+            const auto &s = scenes[n];
+            out << (n ? ",\n" : "\n") << "    {\"name\": \"" << s.name << "\", \"width\": " << s.width
+                << ", \"height\": " << s.height << ", \"samples_per_pixel\": " << s.samples_per_pixel
+                << ", \"max_depth\": " << s.max_depth << ", \"seconds\": " << s.seconds
+                << ", \"samples_per_second\": " << s.samples_per_second;
+            if (stats_enabled)
+                out << ", \"rays\": " << s.rays << ", \"rays_per_second\": " << s.rays / s.seconds;
+            out << "}";
+        }
+        out << "\n  ]\n"
+            << "}\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bench_options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "ERROR: Missing value for '" << arg << "'.\n";
+            return 1;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--filter")
+            options.filter = value;
+        else if (arg == "--out")
+            options.out = value;
+        else if (arg == "--threads")
+            options.threads = std::atoi(value.c_str());
+        else if (arg == "--width")
+            options.image_width = std::atoi(value.c_str());
+        else if (arg == "--spp")
+            options.samples_per_pixel = std::atoi(value.c_str());
+        else if (arg == "--trials")
+            options.trials = std::max(1, std::atoi(value.c_str()));
+        else
+        {
+            std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+            return 1;
+        }
+    }
+
+    auto micro = run_micro_benchmarks(options);
+    auto scenes = run_scene_benchmarks(options);
+
+    if (options.out.empty())
+    {
+        write_json(std::cout, options, micro, scenes);
+        return 0;
+    }
+
+    std::ofstream out(options.out);
+    if (!out)
+    {
+        std::cerr << "ERROR: Could not write benchmark results to '" << options.out << "'.\n";
+        return 1;
+    }
+    write_json(out, options, micro, scenes);
+    return 0;
+}
@@ -2,6 +2,8 @@
 
 #include "rtweekend.h"
 
+#include "stats.h"
+
 class aabb
 {
 public:
@@ -39,6 +41,14 @@ public:
         return aabb(new_x, new_y, new_z);
     }
 
+    double surface_area() const
+    {
+        auto dx = x.size();
+        auto dy = y.size();
+        auto dz = z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
     const interval &axis(int n) const
     {
         if (n == 1)
@@ -50,6 +60,13 @@ public:
 
     bool hit(const ray &r, interval ray_t) const
     {
+        return clip(r, ray_t);
+    }
+
+    bool clip(const ray &r, interval &ray_t) const
+    {
+        // Narrows ray_t to the stretch of the ray inside the box; false if none is left.
+        count_stat(&render_counters::box_tests);
         for (int a = 0; a < 3; a++)
         {
             auto invD = 1 / r.direction()[a]; // 速度
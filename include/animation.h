@@ -0,0 +1,159 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "hittable.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct camera_keyframe
+{
+    double time;
+    point3 lookfrom;
+    point3 lookat;
+    double vfov;
+    double focus_dist;
+};
+
+class camera_animation
+{
+public:
+    int frame_count = 24;                // 输出帧数
+    std::string output_prefix = "frame"; // 输出文件名前缀，帧写入 <prefix>_0000.ppm 等
+    bool parallel_frames = false;        // 多帧同时渲染（每帧单线程），而不是逐帧使用全部线程
+
+    // Called before each frame with the frame index and its keyframe time, so animated scenes
+    // can move objects and refit their BVH. Frames are always rendered in order, one at a time,
+    // when this is set, because the scene is shared between frames.
+    std::function<void(int frame, double time)> update_scene;
+
+    void add_keyframe(const camera_keyframe &key)
+    {
+        keys.push_back(key);
+        std::sort(keys.begin(), keys.end(), [](const camera_keyframe &a, const camera_keyframe &b)
+                  { return a.time < b.time; });
+    }
+
+    void render(const camera &base, const hittable &world) const
+    {
+        // Renders every frame of the sequence with the same scene and acceleration structure.
+        // All camera settings other than the keyframed ones come from base.
+        if (keys.empty() || frame_count < 1)
+        {
+            std::cerr << "ERROR: camera_animation needs at least one keyframe and one frame.\n";
+            return;
+        }
+
+        if (!parallel_frames || update_scene)
+        {
+            for (int frame = 0; frame < frame_count; frame++)
+            {
+                if (update_scene)
+                    update_scene(frame, frame_time(frame));
+
+                std::clog << "Frame " << (frame + 1) << '/' << frame_count << '\n';
+                render_frame(base, world, frame);
+            }
+            return;
+        }
+
+        // Frame-level parallelism: each thread renders whole frames on its own, which avoids
+        // per-tile synchronisation and keeps a thread's working set on one frame at a time.
+        std::atomic<int> next_frame{0};
+        std::atomic<int> frames_done{0};
+        auto worker = [&]
+        {
+            for (int frame = next_frame++; frame < frame_count; frame = next_frame++)
+            {
+                camera cam = base;
+                cam.thread_count = 1;
+                cam.show_progress = false;
+                render_frame(cam, world, frame);
+
+                auto done = ++frames_done;
+                std::clog << "\rFrames remaining: " << (frame_count - done) << ' ' << std::flush;
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < std::min<unsigned int>(hardware_threads(), frame_count); t++)
+            workers.emplace_back(worker);
+        worker();
+        for (auto &w : workers)
+            w.join();
+
+        std::clog << "\rDone.                 \n";
+    }
+
+    std::string frame_filename(int frame) const
+    {
+        std::ostringstream name;
+        name << output_prefix << '_' << std::setw(4) << std::setfill('0') << frame << ".ppm";
+        return name.str();
+    }
+
+private:
+    std::vector<camera_keyframe> keys;
+
+    double frame_time(int frame) const
+    {
+        // Frames are spread evenly from the first keyframe time to the last.
+        auto start = keys.front().time;
+        auto end = keys.back().time;
+        if (frame_count == 1)
+            return start;
+        return start + (end - start) * frame / (frame_count - 1);
+    }
+
+    camera_keyframe key_at(double time) const
+    {
+        // Linear interpolation between the two keyframes that bracket the given time.
+        if (time <= keys.front().time)
+            return keys.front();
+        if (time >= keys.back().time)
+            return keys.back();
+
+        size_t k = 1;
+        while (keys[k].time < time)
+            k++;
+
+        const auto &a = keys[k - 1];
+        const auto &b = keys[k];
+        auto s = (time - a.time) / (b.time - a.time);
+
+        camera_keyframe key;
+        key.time = time;
+        key.lookfrom = (1 - s) * a.lookfrom + s * b.lookfrom;
+        key.lookat = (1 - s) * a.lookat + s * b.lookat;
+        key.vfov = (1 - s) * a.vfov + s * b.vfov;
+        key.focus_dist = (1 - s) * a.focus_dist + s * b.focus_dist;
+        return key;
+    }
+
+    void render_frame(camera cam, const hittable &world, int frame) const
+    {
+        auto key = key_at(frame_time(frame));
+        cam.lookfrom = key.lookfrom;
+        cam.lookat = key.lookat;
+        cam.vfov = key.vfov;
+        cam.focus_dist = key.focus_dist;
+
+        std::ofstream out(frame_filename(frame));
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write frame file '" << frame_filename(frame) << "'.\n";
+            return;
+        }
+        cam.render(world, out);
+    }
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Arbitrary output variables: per-pixel channels written next to the beauty image. Combine
+// the flags to choose which ones camera::render produces.
+enum aov_channel : unsigned int
+{
+    aov_depth = 1u << 0,           // Mean distance to the first hit (infinity where every sample missed)
+    aov_normal = 1u << 1,          // Mean first-hit shading normal
+    aov_albedo = 1u << 2,          // Mean first-hit albedo
+    aov_primitive_id = 1u << 3,    // hittable::object_id() of the primitive the first sample hit
+    aov_material_id = 1u << 4,     // material::material_id() of the first sample's hit
+    aov_sample_count = 1u << 5,    // Camera samples taken for the pixel
+    aov_time = 1u << 6,            // Wall-clock time spent on the pixel, in microseconds
+    aov_bvh_nodes = 1u << 7,       // BVH nodes visited for the pixel (needs RAYTRACING_STATS)
+    aov_primitive_tests = 1u << 8, // Ray-primitive tests for the pixel (needs RAYTRACING_STATS)
+    aov_bounces = 1u << 9,         // Scattering events on the pixel's paths (needs RAYTRACING_STATS)
+    aov_cost = aov_time | aov_bvh_nodes | aov_primitive_tests | aov_bounces,
+    aov_all = (1u << 10) - 1
+};
+
+class aov_buffers
+{
+public:
+    std::vector<float> depth;
+    std::vector<vec3> normal;
+    std::vector<color> albedo;
+    std::vector<std::uint32_t> primitive_id;
+    std::vector<std::uint32_t> material_id;
+    std::vector<std::uint32_t> sample_count;
+    std::vector<float> time;
+    std::vector<std::uint32_t> bvh_nodes;
+    std::vector<std::uint32_t> primitive_tests;
+    std::vector<std::uint32_t> bounces;
+
+    aov_buffers(int width, int height, unsigned int channels)
+        : image_width(width), image_height(height), enabled(channels)
+    {
+        // Only the requested channels get storage.
+        auto pixels = static_cast<size_t>(width) * height;
+        depth.resize(has(aov_depth) ? pixels : 0);
+        normal.resize(has(aov_normal) ? pixels : 0);
+        albedo.resize(has(aov_albedo) ? pixels : 0);
+        primitive_id.resize(has(aov_primitive_id) ? pixels : 0);
+        material_id.resize(has(aov_material_id) ? pixels : 0);
+        sample_count.resize(has(aov_sample_count) ? pixels : 0);
+        time.resize(has(aov_time) ? pixels : 0);
+        bvh_nodes.resize(has(aov_bvh_nodes) ? pixels : 0);
+        primitive_tests.resize(has(aov_primitive_tests) ? pixels : 0);
+        bounces.resize(has(aov_bounces) ? pixels : 0);
+    }
+
+    bool has(aov_channel channel) const { return (enabled & channel) != 0; }
+    bool any() const { return enabled != 0; }
+
+    bool write_exr(const std::string &filename, const std::vector<color> &beauty) const
+    {
+        // Writes the beauty pass (mean linear radiance as R, G, B) and every enabled channel to
+        // one uncompressed scanline OpenEXR file, which compositing packages read directly.
+        // Channels are named Z, N.X/N.Y/N.Z, albedo.R/G/B, renderTime, and as 32-bit unsigned
+        // integers primitiveID, materialID, sampleCount, bvhNodes, primitiveTests and bounces.
+        std::vector<exr_channel> channels;
+        add_color_channels(channels, "", beauty);
+        if (has(aov_depth))
+            channels.push_back(float_channel("Z", depth));
+        if (has(aov_normal))
+            add_vector_channels(channels, "N.X", "N.Y", "N.Z", normal);
+        if (has(aov_albedo))
+            add_color_channels(channels, "albedo.", albedo);
+        if (has(aov_primitive_id))
+            channels.push_back(uint_channel("primitiveID", primitive_id));
+        if (has(aov_material_id))
+            channels.push_back(uint_channel("materialID", material_id));
+        if (has(aov_sample_count))
+            channels.push_back(uint_channel("sampleCount", sample_count));
+        if (has(aov_time))
+            channels.push_back(float_channel("renderTime", time));
+        if (has(aov_bvh_nodes))
+            channels.push_back(uint_channel("bvhNodes", bvh_nodes));
+        if (has(aov_primitive_tests))
+            channels.push_back(uint_channel("primitiveTests", primitive_tests));
+        if (has(aov_bounces))
+            channels.push_back(uint_channel("bounces", bounces));
+
+        // OpenEXR requires channels in alphabetical order, both in the header and in the data.
+        std::sort(channels.begin(), channels.end(),
+                  [](const exr_channel &a, const exr_channel &b) { return a.name < b.name; });
+
+        std::string header;
+        put_bytes(header, "\x76\x2f\x31\x01", 4); // Magic number
+        put_u32(header, 2);                       // Version 2, single-part scanline image
+
+        std::string chlist;
+        for (const auto &channel : channels)
+        {
+            chlist += channel.name;
+            chlist += '\0';
+            put_u32(chlist, channel.pixel_type);
+            put_bytes(chlist, "\0\0\0\0", 4); // pLinear and reserved bytes
+            put_u32(chlist, 1);               // x sampling
+            put_u32(chlist, 1);               // y sampling
+        }
+        chlist += '\0';
+        put_attribute(header, "channels", "chlist", chlist);
+        put_attribute(header, "compression", "compression", std::string(1, '\0'));
+
+        std::string window;
+        put_u32(window, 0);
+        put_u32(window, 0);
+        put_u32(window, static_cast<std::uint32_t>(image_width - 1));
+        put_u32(window, static_cast<std::uint32_t>(image_height - 1));
+        put_attribute(header, "dataWindow", "box2i", window);
+        put_attribute(header, "displayWindow", "box2i", window);
+        put_attribute(header, "lineOrder", "lineOrder", std::string(1, '\0'));
+
+        std::string one, center;
+        put_f32(one, 1.0f);
+        put_f32(center, 0.0f);
+        put_f32(center, 0.0f);
+        put_attribute(header, "pixelAspectRatio", "float", one);
+        put_attribute(header, "screenWindowCenter", "v2f", center);
+        put_attribute(header, "screenWindowWidth", "float", one);
+        header += '\0';
+
+        // One scanline per block: an offset table, then each line as its y coordinate, its
+        // byte count, and every channel's values for that line in turn.
+        auto line_bytes = 4 * static_cast<size_t>(image_width) * channels.size();
+
+        std::string offsets;
+        auto first_line = header.size() + 8 * static_cast<size_t>(image_height);
+        for (int y = 0; y < image_height; y++)
+            put_u64(offsets, first_line + y * (8 + line_bytes));
+
+        std::ofstream out(filename, std::ios::binary);
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write AOV file '" << filename << "'.\n";
+            return false;
+        }
+        out << header << offsets;
+
+        std::string line;
+        for (int y = 0; y < image_height; y++)
+        {
+            line.clear();
+            put_u32(line, static_cast<std::uint32_t>(y));
+            put_u32(line, static_cast<std::uint32_t>(line_bytes));
+            for (const auto &channel : channels)
+                put_bytes(line, channel.data.data() + 4 * static_cast<size_t>(y) * image_width, 4 * image_width);
+            out << line;
+        }
+
+        return static_cast<bool>(out);
+    }
+
+    template <typename T>
+    bool write_heatmap(const std::string &filename, const std::vector<T> &values) const
+    {
+        // False-color PPM of one cost channel: black for no cost through purple, red and
+        // yellow to white at the 99th percentile, so a few extreme pixels do not wash out
+        // the rest. The scale is printed so images from different runs can be compared.
+        std::vector<double> sorted(values.begin(), values.end());
+        if (sorted.empty())
+            return false;
+        auto rank = static_cast<size_t>(0.99 * (sorted.size() - 1));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        auto scale = (sorted[rank] > 0) ? sorted[rank] : 1.0;
+
+        std::ofstream out(filename);
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write heatmap file '" << filename << "'.\n";
+            return false;
+        }
+
+        out << "P3\n"
+            << image_width << ' ' << image_height << "\n255\n";
+        for (auto v : values)
+        {
+            auto c = heat_color(std::fmin(1.0, static_cast<double>(v) / scale));
+            out << static_cast<int>(255.999 * c.x) << ' ' << static_cast<int>(255.999 * c.y) << ' '
+                << static_cast<int>(255.999 * c.z) << '\n';
+        }
+
+        std::clog << "Heatmap " << filename << ": white = " << scale << '\n';
+        return static_cast<bool>(out);
+    }
+
+private:
+    int image_width, image_height;
+    unsigned int enabled;
+
+    struct exr_channel
+    {
+        std::string name;
+        std::uint32_t pixel_type; // 0 = UINT, 2 = FLOAT
+        std::string data;         // Little-endian values, scanline order
+    };
+
+    static color heat_color(double t)
+    {
+        // Piecewise-linear ramp through black, purple, red, yellow and white.
+        static const color stops[5] = {color(0, 0, 0), color(0.35f, 0, 0.55f), color(0.9f, 0.1f, 0.1f),
+                                       color(1, 0.85f, 0), color(1, 1, 1)};
+        auto x = t * 4;
+        auto i = std::min(3, static_cast<int>(x));
+        auto f = static_cast<float>(x - i);
+        return (1 - f) * stops[i] + f * stops[i + 1];
+    }
+
+    static exr_channel float_channel(const std::string &name, const std::vector<float> &values)
+    {
+        exr_channel channel{name, 2, std::string()};
+        for (auto v : values)
+            put_f32(channel.data, v);
+        return channel;
+    }
+
+    static exr_channel uint_channel(const std::string &name, const std::vector<std::uint32_t> &values)
+    {
+        exr_channel channel{name, 0, std::string()};
+        for (auto v : values)
+            put_u32(channel.data, v);
+        return channel;
+    }
+
+    static void add_vector_channels(std::vector<exr_channel> &channels, const std::string &x, const std::string &y,
+                                    const std::string &z, const std::vector<vec3> &values)
+    {
+        std::vector<float> component(values.size());
+        const std::string *names[3] = {&x, &y, &z};
+        for (int c = 0; c < 3; c++)
+        {
+            for (size_t i = 0; i < values.size(); i++)
+                component[i] = values[i][c];
+            channels.push_back(float_channel(*names[c], component));
+        }
+    }
+
+    static void add_color_channels(std::vector<exr_channel> &channels, const std::string &prefix,
+                                   const std::vector<color> &values)
+    {
+        add_vector_channels(channels, prefix + "R", prefix + "G", prefix + "B", values);
+    }
+
+    static void put_bytes(std::string &out, const char *bytes, size_t count) { out.append(bytes, count); }
+
+    static void put_u32(std::string &out, std::uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            out += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+
+    static void put_u64(std::string &out, std::uint64_t v)
+    {
+        for (int i = 0; i < 8; i++)
+            out += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+
+    static void put_f32(std::string &out, float f)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        put_u32(out, bits);
+    }
+
+    static void put_attribute(std::string &out, const std::string &name, const std::string &type,
+                              const std::string &value)
+    {
+        out += name;
+        out += '\0';
+        out += type;
+        out += '\0';
+        put_u32(out, static_cast<std::uint32_t>(value.size()));
+        out += value;
+    }
+};
@@ -4,7 +4,13 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
-#include "algorithm"
+#include "parallel.h"
+#include "stats.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <future>
+#include <mutex>
 
 class bvh_node : public hittable
 {
@@ -12,73 +18,403 @@ public:
     bvh_node(const hittable_list &list) : bvh_node(list.objects, 0, list.objects.size()){};
     bvh_node(const std::vector<shared_ptr<hittable>> &src_objects, size_t start, size_t end)
     {
-        auto objects = src_objects;
-        int axis = random_int(0, 2);
-        auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare
-                                                                    : box_z_compare;
+        // The tree is built over an array of references into src_objects that is partitioned
+        // in place, so the object list itself is never copied. Subtrees near the root are built
+        // as parallel tasks, and the binning and partitioning passes at the top levels are
+        // split across threads.
+        scoped_phase timer(render_phase::bvh_build);
+        build_context ctx(src_objects, start, end);
+        build(ctx, 0, ctx.refs.size(), 0);
+        built_cost = sah_cost();
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        // Nodes over moving objects test their bounds at the ray's own time, which are far
+        // tighter than the box swept over the whole motion.
+        count_stat(&render_counters::bvh_nodes);
+        if (!(moving ? box_at(r.time()) : box).hit(r, ray_t))
+            return false;
+
+        bool hit_left = left->hit(r, ray_t, rec);
+        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    bool occluded(const ray &r, interval ray_t, double &transmittance) const override
+    {
+        count_stat(&render_counters::bvh_nodes);
+        if (!(moving ? box_at(r.time()) : box).hit(r, ray_t))
+            return false;
+
+        // Leaves may hold one object twice; a medium must only attenuate once.
+        return left->occluded(r, ray_t, transmittance) ||
+               (right != left && right->occluded(r, ray_t, transmittance));
+    }
+
+    bool hit_interval(const ray &r, interval &crossings) const override
+    {
+        count_stat(&render_counters::bvh_nodes);
+        if (!(moving ? box_at(r.time()) : box).hit(r, interval(-infinity, +infinity)))
+            return false;
+
+        bool crossed = left->hit_interval(r, crossings);
+        if (right != left)
+            crossed |= right->hit_interval(r, crossings);
+        return crossed;
+    }
+
+    aabb bounding_box() const override { return box; }
+
+    aabb bounding_box_at(double time) const override { return moving ? box_at(time) : box; }
+
+    void collect_emitters(std::vector<const hittable *> &emitters) const override
+    {
+        left->collect_emitters(emitters);
+        if (right != left)
+            right->collect_emitters(emitters);
+    }
+
+    void refit() override
+    {
+        // Recompute the bounds of every node bottom-up, keeping the tree topology.
+        left->refit();
+        if (right != left)
+            right->refit();
+
+        set_bounds();
+    }
+
+    bool update(double rebuild_threshold = 1.5)
+    {
+        // Refit the tree for primitives that have moved, then rebuild it from scratch if the
+        // refit tree's traversal cost has grown past rebuild_threshold times the cost it had
+        // when it was last built. Returns true if the tree was rebuilt.
+        refit();
+        if (sah_cost() <= rebuild_threshold * built_cost)
+            return false;
+
+        std::vector<shared_ptr<hittable>> objects;
+        collect_objects(objects);
+        *this = bvh_node(objects, 0, objects.size());
+        return true;
+    }
+
+    double sah_cost() const
+    {
+        // Summed surface area of all nodes relative to the root: proportional to the expected
+        // number of node visits for a random ray that hits the root.
+        auto root_area = box.surface_area();
+        return (root_area > 0) ? area_sum / root_area : 1;
+    }
+
+private:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb box;              // Bounds over the whole shutter interval
+    aabb box0, box1;       // Bounds at time 0 and time 1, interpolated for moving nodes
+    bool moving = false;   // True when box0 and box1 differ
+    bool interior = false; // True when both children are bvh_nodes
+    double area_sum = 0;   // Surface area of this node plus all nodes below it
+    double built_cost = 1; // sah_cost() just after the last full build
+
+    static constexpr int bin_count = 16;
+    static constexpr size_t parallel_threshold = 4096; // Smaller spans are always built serially.
+
+    struct build_ref
+    {
+        // The object's bounds travel with its index, so the partitioning passes stream through
+        // memory instead of chasing object pointers.
+        aabb box;
+        size_t object;
+
+        double centroid(int axis) const
+        {
+            const auto &ival = box.axis(axis);
+            return 0.5 * (ival.min + ival.max);
+        }
+    };
+
+    struct build_context
+    {
+        const std::vector<shared_ptr<hittable>> &objects;
+        size_t first;                 // Offset of the object range within objects
+        std::vector<build_ref> refs;  // One entry per object, partitioned in place
+        unsigned int threads;
+        int max_task_depth;
+
+        build_context(const std::vector<shared_ptr<hittable>> &src_objects, size_t start, size_t end)
+            : objects(src_objects), first(start), refs(end - start)
+        {
+            threads = hardware_threads();
+
+            // Spawn a few more subtree tasks than there are threads to even out the load.
+            max_task_depth = 2;
+            while ((1u << (max_task_depth - 2)) < threads)
+                max_task_depth++;
+
+            parallel_for(0, refs.size(), parallel_threshold, [&](size_t b, size_t e)
+                         {
+                for (size_t i = b; i < e; i++)
+                    refs[i] = {objects[first + i]->bounding_box(), first + i}; });
+        }
+
+        const shared_ptr<hittable> &object(size_t i) const { return objects[refs[i].object]; }
+
+        bool run_parallel(size_t span, int depth) const
+        {
+            // Data-parallel passes only pay off while there are fewer subtree tasks than threads.
+            return span >= parallel_threshold && (1u << depth) < threads;
+        }
+    };
+
+    struct bin
+    {
+        aabb bounds;
+        size_t count = 0;
+    };
+
+    bvh_node() {}
+
+    void build(build_context &ctx, size_t start, size_t end, int depth)
+    {
         size_t object_span = end - start;
+
         if (object_span == 1)
         {
-            left = right = objects[start];
+            left = right = ctx.object(start);
         }
         else if (object_span == 2)
         {
-            if (comparator(objects[start], objects[start + 1]))
+            left = ctx.object(start);
+            right = ctx.object(start + 1);
+        }
+        else
+        {
+            auto mid = split(ctx, start, end, depth);
+
+            auto left_node = shared_ptr<bvh_node>(new bvh_node());
+            auto right_node = shared_ptr<bvh_node>(new bvh_node());
+
+            if (depth < ctx.max_task_depth && object_span >= parallel_threshold)
             {
-                left = objects[start];
-                right = objects[start + 1];
+                auto left_task = std::async(std::launch::async, [&]
+                                            { left_node->build(ctx, start, mid, depth + 1); });
+                right_node->build(ctx, mid, end, depth + 1);
+                left_task.get();
             }
             else
             {
-                left = objects[start + 1];
-                right = objects[start];
+                left_node->build(ctx, start, mid, depth + 1);
+                right_node->build(ctx, mid, end, depth + 1);
             }
-        }
-        else
-        {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
-            auto mid = start + object_span / 2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            left = left_node;
+            right = right_node;
+            interior = true;
         }
-        box = aabb(left->bounding_box(), right->bounding_box());
+
+        set_bounds();
     }
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
-    {
-        if (!box.hit(r, ray_t))
-            return false;
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+    void set_bounds()
+    {
+        box = aabb(left->bounding_box(), right->bounding_box());
+        box0 = aabb(left->bounding_box_at(0), right->bounding_box_at(0));
+        box1 = aabb(left->bounding_box_at(1), right->bounding_box_at(1));
+        moving = !same_box(box0, box1);
 
-        return hit_left || hit_right;
+        area_sum = box.surface_area();
+        if (interior)
+            area_sum += static_cast<bvh_node *>(left.get())->area_sum +
+                        static_cast<bvh_node *>(right.get())->area_sum;
     }
 
-    aabb bounding_box() const override { return box; }
-
-private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb box;
+    aabb box_at(double time) const
+    {
+        // Children move linearly (or are bounded by linear motion), so interpolating the end
+        // boxes gives conservative bounds for any time in between.
+        auto lerp = [time](const interval &a, const interval &b)
+        {
+            return interval((1 - time) * a.min + time * b.min, (1 - time) * a.max + time * b.max);
+        };
+        return aabb(lerp(box0.x, box1.x), lerp(box0.y, box1.y), lerp(box0.z, box1.z));
+    }
 
-    static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index)
+    static bool same_box(const aabb &a, const aabb &b)
     {
-        return a->bounding_box().axis(axis_index).min < b->bounding_box().axis(axis_index).min;
+        for (int axis = 0; axis < 3; axis++)
+            if (a.axis(axis).min != b.axis(axis).min || a.axis(axis).max != b.axis(axis).max)
+                return false;
+        return true;
     }
 
-    static bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    void collect_objects(std::vector<shared_ptr<hittable>> &objects) const
     {
-        return box_compare(a, b, 0);
+        if (interior)
+        {
+            static_cast<bvh_node *>(left.get())->collect_objects(objects);
+            static_cast<bvh_node *>(right.get())->collect_objects(objects);
+            return;
+        }
+
+        objects.push_back(left);
+        if (right != left)
+            objects.push_back(right);
     }
 
-    static bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    static size_t split(build_context &ctx, size_t start, size_t end, int depth)
     {
-        return box_compare(a, b, 1);
+        // Partitions refs [start,end) into two non-empty halves chosen with a binned surface
+        // area heuristic along the longest centroid axis, and returns where the halves meet.
+        bool parallel = ctx.run_parallel(end - start, depth);
+        size_t chunk = parallel ? parallel_threshold : end - start;
+        std::mutex merge_mutex;
+
+        double cmin[3] = {+infinity, +infinity, +infinity};
+        double cmax[3] = {-infinity, -infinity, -infinity};
+        parallel_for(start, end, chunk, [&](size_t b, size_t e)
+                     {
+            double lo[3] = {+infinity, +infinity, +infinity};
+            double hi[3] = {-infinity, -infinity, -infinity};
+            for (size_t i = b; i < e; i++)
+            {
+                for (int a = 0; a < 3; a++)
+                {
+                    auto c = ctx.refs[i].centroid(a);
+                    lo[a] = std::min(lo[a], c);
+                    hi[a] = std::max(hi[a], c);
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            for (int a = 0; a < 3; a++)
+            {
+                cmin[a] = std::min(cmin[a], lo[a]);
+                cmax[a] = std::max(cmax[a], hi[a]);
+            } });
+
+        int axis = 0;
+        double extent[3] = {cmax[0] - cmin[0], cmax[1] - cmin[1], cmax[2] - cmin[2]};
+        if (extent[1] > extent[axis])
+            axis = 1;
+        if (extent[2] > extent[axis])
+            axis = 2;
+
+        // All centroids coincide, so no plane separates them; any even split is as good.
+        if (!(extent[axis] > 0))
+            return start + (end - start) / 2;
+
+        double axis_min = cmin[axis];
+        double bin_scale = bin_count / extent[axis];
+        auto bin_index = [&](const build_ref &ref)
+        {
+            auto b = static_cast<int>(bin_scale * (ref.centroid(axis) - axis_min));
+            return (b < bin_count) ? b : bin_count - 1;
+        };
+
+        bin bins[bin_count];
+        parallel_for(start, end, chunk, [&](size_t b, size_t e)
+                     {
+            bin local[bin_count];
+            for (size_t i = b; i < e; i++)
+            {
+                auto &target = local[bin_index(ctx.refs[i])];
+                target.bounds = aabb(target.bounds, ctx.refs[i].box);
+                target.count++;
+            }
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            for (int k = 0; k < bin_count; k++)
+            {
+                bins[k].bounds = aabb(bins[k].bounds, local[k].bounds);
+                bins[k].count += local[k].count;
+            } });
+
+        // Sweep from both ends to find the plane with the lowest SAH cost. Because the bins
+        // span the centroid bounds exactly, the first and last bins are never empty.
+        double right_cost[bin_count];
+        aabb right_bounds;
+        size_t right_count = 0;
+        for (int k = bin_count - 1; k > 0; k--)
+        {
+            right_bounds = aabb(right_bounds, bins[k].bounds);
+            right_count += bins[k].count;
+            right_cost[k] = right_count ? right_count * right_bounds.surface_area() : 0;
+        }
+
+        int best_plane = 0;
+        double best_cost = infinity;
+        aabb left_bounds;
+        size_t left_count = 0;
+        for (int k = 0; k < bin_count - 1; k++)
+        {
+            left_bounds = aabb(left_bounds, bins[k].bounds);
+            left_count += bins[k].count;
+            auto cost = (left_count ? left_count * left_bounds.surface_area() : 0) + right_cost[k + 1];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_plane = k;
+            }
+        }
+
+        auto mid = partition(ctx.refs, start, end, chunk, [&](const build_ref &ref)
+                             { return bin_index(ref) <= best_plane; });
+
+        // Numerically degenerate boxes can still leave one side empty; fall back to the median.
+        if (mid == start || mid == end)
+        {
+            mid = start + (end - start) / 2;
+            std::nth_element(ctx.refs.begin() + start, ctx.refs.begin() + mid,
+                             ctx.refs.begin() + end, [&](const build_ref &a, const build_ref &b)
+                             { return a.centroid(axis) < b.centroid(axis); });
+        }
+
+        return mid;
     }
 
-    static bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    template <typename Pred>
+    static size_t partition(std::vector<build_ref> &v, size_t start, size_t end, size_t chunk, Pred pred)
     {
-        return box_compare(a, b, 2);
+        // In-place partition of v[start,end). Each chunk is partitioned by its own thread, then
+        // the elements left on the wrong side of the overall split point are swapped pairwise.
+        struct piece
+        {
+            size_t begin, split, end;
+        };
+        std::vector<piece> pieces;
+        std::mutex pieces_mutex;
+
+        parallel_for(start, end, chunk, [&](size_t b, size_t e)
+                     {
+            auto s = std::partition(v.begin() + b, v.begin() + e, pred) - v.begin();
+            std::lock_guard<std::mutex> lock(pieces_mutex);
+            pieces.push_back({b, static_cast<size_t>(s), e}); });
+
+        if (pieces.size() == 1)
+            return pieces[0].split;
+
+        std::sort(pieces.begin(), pieces.end(), [](const piece &a, const piece &b)
+                  { return a.begin < b.begin; });
+
+        size_t mid = start;
+        for (const auto &p : pieces)
+            mid += p.split - p.begin;
+
+        std::vector<size_t> misplaced_true, misplaced_false;
+        for (const auto &p : pieces)
+        {
+            for (auto i = std::max(p.begin, mid); i < p.split; i++)
+                misplaced_true.push_back(i);
+            for (auto i = p.split; i < std::min(p.end, mid); i++)
+                misplaced_false.push_back(i);
+        }
+
+        parallel_for(0, misplaced_true.size(), chunk, [&](size_t b, size_t e)
+                     {
+            for (size_t i = b; i < e; i++)
+                std::swap(v[misplaced_true[i]], v[misplaced_false[i]]); });
+
+        return mid;
     }
-};
\ No newline at end of file
+};
@@ -2,10 +2,24 @@
 
 #include "rtweekend.h"
 
+#include "aov.h"
+#include "denoiser.h"
+#include "environment.h"
 #include "hittable.h"
+#include "lights.h"
 #include "material.h"
+#include "parallel.h"
+#include "sampler.h"
+#include "timing.h"
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
 class camera
 {
@@ -15,6 +29,10 @@ public:
     int samples_per_pixel = 10; // 每个像素的随机采样次数
     int max_depth = 10;         // 光线在场景中的最大反射次数
     color background;
+    shared_ptr<environment_light> environment; // 环境贴图光照（设置后取代 background）
+
+    bool sample_lights = true;                            // 是否对发光图元做显式采样（直接光照）
+    light_selection light_sampling = light_selection::bvh; // 多光源时选取发光图元的方式
 
     double vfov = 90;                   // 垂直视角（视野）
     point3 lookfrom = point3(0, 0, -1); // 摄像机位置
@@ -24,32 +42,207 @@ public:
     double defocus_angle = 0; // 每个像素的光线偏转角度
     double focus_dist = 10;   // 摄像机到完美焦点平面的距离
 
+    sampler_type sampling = sampler_type::sobol; // 像素、镜头、时间与反弹方向的采样器
+    unsigned int sample_seed = 0;                // 采样序列的种子（不同的值给出不同的噪声图案）
+
+    int thread_count = 0;      // 渲染线程数（0 表示使用全部硬件线程）
+    bool show_progress = true; // 是否在 std::clog 上输出进度
+    double progress_interval = 1.0; // 进度报告的最短间隔（秒）
+    bool denoise = false;      // 是否用反照率/法线/深度特征缓冲对结果降噪
+    denoiser filter;           // 降噪滤波器参数
+
+    unsigned int aovs = 0;                  // 额外输出的 AOV 通道（aov_channel 标志的组合）
+    std::string aov_filename = "aov.exr";   // AOV 输出文件（OpenEXR，同时包含 RGB 主图像）
+    bool cost_heatmap = false;              // 是否输出每像素渲染开销热力图（计数需要 RAYTRACING_STATS）
+    std::string heatmap_prefix = "heatmap"; // 热力图文件名前缀
+    render_counters stats;                  // 最近一次渲染的光线与求交统计（需要 RAYTRACING_STATS）
+
     void render(const hittable &world)
+    {
+        render(world, std::cout);
+    }
+
+    void render(const hittable &world, std::ostream &out)
     {
         initialize();
+        build_light_selector(world);
 
-        std::cout << "P3\n"
-                  << image_width << ' ' << image_height << "\n255\n";
+        // The image is split into square tiles that worker threads claim one at a time, so
+        // threads that draw cheap tiles simply take more of them.
+        std::vector<color> framebuffer(image_width * image_height);
+        auto pixels = denoise ? framebuffer.size() : 0;
+        std::vector<color> illumination(pixels), albedo(pixels);
+        std::vector<vec3> normal(pixels);
+        std::vector<double> depth(pixels), variance(pixels);
+        aov_buffers aov(image_width, image_height, cost_heatmap ? (aovs | aov_cost) : aovs);
+        if (cost_heatmap && !stats_enabled)
+            std::cerr << "WARNING: Built without RAYTRACING_STATS; the cost heatmaps only show time.\n";
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        int tiles_y = (image_height + tile_size - 1) / tile_size;
+        int tile_count = tiles_x * tiles_y;
+        std::atomic<int> next_tile{0};
+        std::mutex stats_mutex;
+        stats = render_counters();
+        progress_reporter progress(std::clog,
+                                   static_cast<std::uint64_t>(image_width) * image_height * samples_per_pixel,
+                                   progress_interval);
 
-        for (int j = 0; j < image_height; ++j)
+        auto &trace = trace_recorder::global();
+        auto worker = [&]
         {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i)
+            auto counters_before = thread_counters();
+            auto pixel_sampler = make_sampler(sampling, samples_per_pixel, sample_seed);
+            active_sampler() = pixel_sampler.get();
+            for (int tile = next_tile++; tile < tile_count; tile = next_tile++)
             {
-                color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; ++sample)
+                auto tile_start = trace.is_enabled() ? std::chrono::steady_clock::now()
+                                                     : std::chrono::steady_clock::time_point();
+                int x0 = (tile % tiles_x) * tile_size;
+                int y0 = (tile / tiles_x) * tile_size;
+                int x1 = std::min(x0 + tile_size, image_width);
+                int y1 = std::min(y0 + tile_size, image_height);
+
+                for (int j = y0; j < y1; ++j)
                 {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
+                    for (int i = x0; i < x1; ++i)
+                    {
+                        if (denoise || aov.any())
+                        {
+                            render_features(i, j, world, framebuffer, illumination, albedo, normal, depth, variance,
+                                            aov);
+                            continue;
+                        }
+
+                        color pixel_color(0, 0, 0);
+                        for (int sample = 0; sample < samples_per_pixel; ++sample)
+                        {
+                            ray r = get_ray(i, j, sample);
+                            pixel_color += ray_color(r, max_depth, world);
+                        }
+                        framebuffer[j * image_width + i] = pixel_color;
+                    }
                 }
-                write_color(std::cout, pixel_color, samples_per_pixel);
+
+                if (trace.is_enabled())
+                    trace.record("tile", "render", tile_start, std::chrono::steady_clock::now(),
+                                 "\"x\": " + std::to_string(x0) + ", \"y\": " + std::to_string(y0) +
+                                     ", \"width\": " + std::to_string(x1 - x0) + ", \"height\": " +
+                                     std::to_string(y1 - y0));
+
+                if (show_progress)
+                    progress.advance(static_cast<std::uint64_t>(x1 - x0) * (y1 - y0) * samples_per_pixel);
             }
+
+            active_sampler() = nullptr;
+
+            // Each thread folds what it counted into the render's totals once, at the end.
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats += thread_counters() - counters_before;
+        };
+
+        auto threads = (thread_count > 0) ? thread_count : static_cast<int>(hardware_threads());
+        auto start = std::chrono::steady_clock::now();
+        std::optional<scoped_phase> phase(render_phase::render);
+        {
+            texture_render_scope textures;
+            std::vector<std::thread> workers;
+            for (int t = 1; t < threads; t++)
+                workers.emplace_back(worker);
+            worker();
+            for (auto &w : workers)
+                w.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (show_progress)
+            progress.finish();
+
+        phase.emplace(render_phase::denoise);
+
+        if (denoise)
+        {
+            auto filtered = filter.apply(image_width, image_height, std::move(illumination), std::move(variance),
+                                         albedo, normal, depth);
+            for (size_t p = 0; p < framebuffer.size(); p++)
+                framebuffer[p] = static_cast<float>(samples_per_pixel) * filtered[p];
+        }
+
+        phase.emplace(render_phase::output);
+
+        if (aov.any())
+        {
+            std::vector<color> beauty(framebuffer.size());
+            for (size_t p = 0; p < framebuffer.size(); p++)
+                beauty[p] = framebuffer[p] / static_cast<float>(samples_per_pixel);
+            aov.write_exr(aov_filename, beauty);
+        }
+
+        if (cost_heatmap)
+        {
+            aov.write_heatmap(heatmap_prefix + "_time.ppm", aov.time);
+            aov.write_heatmap(heatmap_prefix + "_nodes.ppm", aov.bvh_nodes);
+            aov.write_heatmap(heatmap_prefix + "_tests.ppm", aov.primitive_tests);
+            aov.write_heatmap(heatmap_prefix + "_bounces.ppm", aov.bounces);
         }
 
-        std::clog << "\rDone.                 \n";
+        out << "P3\n"
+            << image_width << ' ' << image_height << "\n255\n";
+        for (const auto &pixel_color : framebuffer)
+            write_color(out, pixel_color, samples_per_pixel);
+        phase.reset();
+
+        if (stats_enabled && show_progress)
+            stats.report(std::clog, elapsed.count(),
+                         static_cast<std::uint64_t>(image_width) * image_height * samples_per_pixel);
+    }
+
+    std::vector<color> render_region(const hittable &world, int x0, int y0, int x1, int y1, int first_sample,
+                                     int sample_count)
+    {
+        // Renders samples [first_sample, first_sample + sample_count) of every pixel in the
+        // rectangle [x0,x1) x [y0,y1), clipped to the image, and returns their radiance sums
+        // row by row, not divided by the count. Each sample index draws the same sampler
+        // numbers as in render(), media included, so regions and sample ranges rendered apart
+        // (by other processes, say) add up to the same image. The independent sampler is the
+        // exception: its numbers come from random_double(). No progress, AOVs or denoising.
+        initialize();
+        build_light_selector(world);
+        x1 = std::min(x1, image_width);
+        y1 = std::min(y1, image_height);
+
+        auto width = x1 - x0;
+        std::vector<color> sums(static_cast<size_t>(std::max(0, width)) * std::max(0, y1 - y0));
+        std::atomic<int> next_row{y0};
+        auto worker = [&]
+        {
+            auto pixel_sampler = make_sampler(sampling, samples_per_pixel, sample_seed);
+            active_sampler() = pixel_sampler.get();
+            for (int j = next_row++; j < y1; j = next_row++)
+            {
+                for (int i = x0; i < x1; ++i)
+                {
+                    color pixel_color(0, 0, 0);
+                    for (int sample = first_sample; sample < first_sample + sample_count; ++sample)
+                        pixel_color += ray_color(get_ray(i, j, sample), max_depth, world);
+                    sums[static_cast<size_t>(j - y0) * width + (i - x0)] = pixel_color;
+                }
+            }
+            active_sampler() = nullptr;
+        };
+
+        auto threads = (thread_count > 0) ? thread_count : static_cast<int>(hardware_threads());
+        texture_render_scope textures;
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++)
+            workers.emplace_back(worker);
+        worker();
+        for (auto &w : workers)
+            w.join();
+        return sums;
     }
 
 private:
+    static constexpr int tile_size = 32; // 并行渲染的图块边长（像素）
+
     int image_height;    // 渲染图像的高度
     point3 center;       // 摄像机中心
     point3 pixel00_loc;  // 左上角像素的位置
@@ -58,6 +251,8 @@ private:
     vec3 u, v, w;        // 摄像机坐标系的基向量
     vec3 defocus_disk_u; // 散焦光圈的水平半径
     vec3 defocus_disk_v; // 散焦光圈的垂直半径
+    double differential_scale; // 光线微分相对于像素间距的比例
+    shared_ptr<light_selector> lights; // 本次渲染可直接采样的发光图元
 
     void initialize()
     {
@@ -87,55 +282,286 @@ private:
         auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
+
+        differential_scale = fmax(0.125, 1.0 / sqrt(samples_per_pixel));
+    }
+
+    void build_light_selector(const hittable &world)
+    {
+        lights.reset();
+        if (!sample_lights)
+            return;
+
+        std::vector<const hittable *> emitters;
+        world.collect_emitters(emitters);
+        auto selector = make_light_selector(light_sampling, std::move(emitters));
+        if (!selector->empty())
+            lights = std::move(selector);
     }
 
-    ray get_ray(int i, int j) const
+    ray get_ray(int i, int j, int sample) const
     {
+        // Starts camera sample `sample` of pixel (i,j) on the thread's sampler; the pixel
+        // jitter, lens position and time are its first dimensions.
+        if (auto s = active_sampler())
+            s->start_sample(i, j, sample);
+
         auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
         auto pixel_sample = pixel_center + pixel_sample_square();
 
         auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = random_double();
+        set_sample_dimension(2); // Time keeps its dimension when there is no lens sample
+        auto ray_time = sample_1d();
 
-        return ray(ray_origin, ray_direction, ray_time);
+        // Differentials span one sample's share of the pixel, so texture filtering narrows as
+        // the sample count grows.
+        ray r(ray_origin, ray_direction, ray_time);
+        r.set_differentials(ray_origin, ray_direction + differential_scale * pixel_delta_u,
+                            ray_origin, ray_direction + differential_scale * pixel_delta_v);
+        return r;
     }
 
     vec3 pixel_sample_square() const
     {
         // 返回原点周围正方形内的随机点。
-        auto px = -0.5 + random_double();
-        auto py = -0.5 + random_double();
+        auto s = sample_2d();
+        auto px = -0.5 + s.u;
+        auto py = -0.5 + s.v;
         return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 
     point3 defocus_disk_sample() const
     {
         // 返回摄像机散焦光圈内的随机点。
-        auto p = random_in_unit_disk();
+        auto p = sample_in_unit_disk();
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray &r, int depth, const hittable &world) const
+    void render_features(int i, int j, const hittable &world, std::vector<color> &framebuffer,
+                         std::vector<color> &illumination, std::vector<color> &albedo, std::vector<vec3> &normal,
+                         std::vector<double> &depth, std::vector<double> &variance, aov_buffers &aov) const
     {
+        // Renders pixel (i,j) for the denoiser and the AOVs: besides the radiance sum it
+        // records the mean first-hit features, the mean of radiance divided by each sample's
+        // albedo, the variance of that mean's luminance, and the first sample's hit IDs.
+        auto start = std::chrono::steady_clock::now();
+        auto counters_before = thread_counters();
+        color radiance_sum(0, 0, 0), illumination_sum(0, 0, 0), albedo_sum(0, 0, 0);
+        vec3 normal_sum(0, 0, 0);
+        double depth_sum = 0, hit_depth_sum = 0, luminance_sum = 0, luminance_squares = 0;
+        int hits = 0;
+        feature_sample first;
+
+        for (int sample = 0; sample < samples_per_pixel; ++sample)
+        {
+            feature_sample features;
+            auto radiance = ray_color(get_ray(i, j, sample), max_depth, world, &features);
+            if (sample == 0)
+                first = features;
+            if (features.primitive_id != 0)
+            {
+                hits++;
+                hit_depth_sum += features.depth;
+            }
+            auto demodulation = denoiser::demodulation_albedo(features.albedo);
+            color sample_illumination(radiance.x / demodulation.x, radiance.y / demodulation.y,
+                                      radiance.z / demodulation.z);
+            auto l = denoiser::luminance(sample_illumination);
+
+            radiance_sum += radiance;
+            illumination_sum += sample_illumination;
+            albedo_sum += features.albedo;
+            normal_sum += features.normal;
+            depth_sum += features.depth;
+            luminance_sum += l;
+            luminance_squares += l * l;
+        }
+
+        auto n = static_cast<double>(samples_per_pixel);
+        auto p = static_cast<size_t>(j) * image_width + i;
+        framebuffer[p] = radiance_sum;
+
+        if (denoise)
+        {
+            auto mean_luminance = luminance_sum / n;
+            illumination[p] = illumination_sum / n;
+            albedo[p] = albedo_sum / n;
+            normal[p] = normal_sum / n;
+            depth[p] = depth_sum / n;
+            variance[p] = std::fmax(0.0, luminance_squares / n - mean_luminance * mean_luminance) / n;
+        }
+
+        if (aov.has(aov_depth))
+            aov.depth[p] = static_cast<float>(hits > 0 ? hit_depth_sum / hits : infinity);
+        if (aov.has(aov_normal))
+            aov.normal[p] = normal_sum / n;
+        if (aov.has(aov_albedo))
+            aov.albedo[p] = albedo_sum / n;
+        if (aov.has(aov_primitive_id))
+            aov.primitive_id[p] = first.primitive_id;
+        if (aov.has(aov_material_id))
+            aov.material_id[p] = first.material_id;
+        if (aov.has(aov_sample_count))
+            aov.sample_count[p] = static_cast<std::uint32_t>(samples_per_pixel);
+        if (aov.has(aov_time))
+            aov.time[p] = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        auto cost = thread_counters() - counters_before;
+        if (aov.has(aov_bvh_nodes))
+            aov.bvh_nodes[p] = static_cast<std::uint32_t>(cost.bvh_nodes);
+        if (aov.has(aov_primitive_tests))
+            aov.primitive_tests[p] = static_cast<std::uint32_t>(cost.primitive_tests());
+        if (aov.has(aov_bounces))
+            aov.bounces[p] = static_cast<std::uint32_t>(cost.bounces);
+    }
+
+    color ray_color(const ray &r, int depth, const hittable &world, feature_sample *features = nullptr,
+                    double scatter_pdf = 0) const
+    {
+        // When features is given, the first surface hit (or the miss) is recorded in it.
+        // scatter_pdf is the density r was drawn with by the previous bounce (0 for camera
+        // rays and specular bounces), for weighting the environment or light it finds.
         hit_record rec;
 
         if (depth <= 0)
             return color(0, 0, 0);
 
         // If the ray hits nothing, return the background color.
+        count_stat(&render_counters::rays);
         if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
+        {
+            if (!environment)
+            {
+                if (features)
+                    features->albedo = background;
+                return background;
+            }
+
+            auto radiance = environment->value(r.direction());
+            if (features)
+                features->albedo = radiance;
+            if (scatter_pdf > 0)
+                radiance = static_cast<float>(power_heuristic(scatter_pdf, environment->pdf(r.direction()))) * radiance;
+            return radiance;
+        }
+
+        if (features)
+        {
+            features->albedo = rec.mat->base_color(rec);
+            features->normal = rec.normal;
+            features->depth = rec.t * r.direction().length();
+            features->primitive_id = rec.primitive_id;
+            features->material_id = rec.mat->material_id();
+        }
 
         ray scattered;
         color attenuation;
+        double pdf;
         color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+        if (lights && scatter_pdf > 0)
+        {
+            // A light the previous bounce could also have sampled directly.
+            if (auto light = lights->light(rec.primitive_id))
+            {
+                auto light_pdf = lights->pmf(r.origin(), light) * light->pdf_value(r.origin(), r.direction(), r.time());
+                color_from_emission = static_cast<float>(power_heuristic(scatter_pdf, light_pdf)) * color_from_emission;
+            }
+        }
 
-        if (!rec.mat->scatter(r, rec, attenuation, scattered))
+        // Each bounce draws from its own fixed dimensions of the camera sample: after the
+        // pixel, lens and time dimensions, five per bounce.
+        auto bounce_dimension = 3 + 5 * (max_depth - depth);
+        set_sample_dimension(bounce_dimension);
+        if (!rec.mat->scatter(r, rec, attenuation, scattered, pdf))
             return color_from_emission;
+        count_stat(&render_counters::bounces);
+
+        if (environment && pdf > 0)
+        {
+            set_sample_dimension(bounce_dimension + 2);
+            color_from_emission += attenuation * environment_light_sample(r, rec, world);
+        }
+        if (lights && pdf > 0)
+        {
+            set_sample_dimension(bounce_dimension + 3);
+            color_from_emission += attenuation * emitter_light_sample(r, rec, world);
+        }
 
-        color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world);
+        // Sampled directions are weighted by how the material scatters into them over how
+        // likely they were to be drawn; specular ones (pdf 0) carry their attenuation alone.
+        if (pdf > 0)
+            attenuation = static_cast<float>(rec.mat->scattering_pdf(r, rec, scattered) / pdf) * attenuation;
+        color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world, nullptr, pdf);
 
         return color_from_emission + color_from_scatter;
     }
+
+    color environment_light_sample(const ray &r, const hit_record &rec, const hittable &world) const
+    {
+        // Next-event estimate of the environment seen from a non-specular hit, per unit of
+        // attenuation: one direction drawn from the environment map, traced as a shadow ray
+        // and weighted against the material's own sampling of it. Materials that sample
+        // (pdf > 0) draw directions in proportion to scattering_pdf, so that is the density
+        // the material would have picked this direction with.
+        double light_pdf;
+        auto direction = environment->sample(sample_2d(), light_pdf);
+        if (light_pdf <= 0)
+            return color(0, 0, 0);
+
+        ray shadow(rec.p, direction, r.time());
+        auto material_pdf = rec.mat->scattering_pdf(r, rec, shadow);
+        if (material_pdf <= 0)
+            return color(0, 0, 0);
+
+        double transmittance = 1;
+        count_stat(&render_counters::rays);
+        if (world.occluded(shadow, interval(0.001, infinity), transmittance))
+            return color(0, 0, 0);
+
+        auto weight = transmittance * power_heuristic(light_pdf, material_pdf) * material_pdf / light_pdf;
+        return static_cast<float>(weight) * environment->value(direction);
+    }
+
+    color emitter_light_sample(const ray &r, const hit_record &rec, const hittable &world) const
+    {
+        // Next-event estimate of one emitting primitive, chosen by the light selector and
+        // sampled by the primitive itself, per unit of attenuation and weighted against the
+        // material's own sampling as for the environment.
+        double pmf;
+        auto light = lights->sample(rec.p, sample_1d(), pmf);
+        if (!light)
+            return color(0, 0, 0);
+
+        auto direction = light->random(rec.p, sample_2d(), r.time());
+        auto light_pdf = pmf * light->pdf_value(rec.p, direction, r.time());
+        if (light_pdf <= 0)
+            return color(0, 0, 0);
+
+        ray shadow(rec.p, direction, r.time());
+        auto material_pdf = rec.mat->scattering_pdf(r, rec, shadow);
+        if (material_pdf <= 0)
+            return color(0, 0, 0);
+
+        // The shadow ray must reach the chosen light with nothing opaque on the way.
+        hit_record light_rec;
+        if (!light->hit(shadow, interval(0.001, infinity), light_rec))
+            return color(0, 0, 0);
+        double transmittance = 1;
+        count_stat(&render_counters::rays);
+        if (world.occluded(shadow, interval(0.001, light_rec.t * (1 - 1e-4)), transmittance))
+            return color(0, 0, 0);
+
+        auto weight = transmittance * power_heuristic(light_pdf, material_pdf) * material_pdf / light_pdf;
+        return static_cast<float>(weight) * light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p);
+    }
+
+    static double power_heuristic(double pdf, double other_pdf)
+    {
+        // Veach's multiple importance sampling weight (power 2) for a sample drawn with pdf
+        // that another technique could have drawn with other_pdf.
+        auto a = pdf * pdf;
+        auto b = other_pdf * other_pdf;
+        return (a + b > 0) ? a / (a + b) : 0;
+    }
 };
@@ -10,7 +10,13 @@ inline double linear_to_gamma(double linear_component)
     return std::pow(linear_component, 1 / 2.2);
 }
 
-inline void write_color(std::ostream &out, color pixel_color, int samples_per_pixel)
+inline double luminance(const color &c)
+{
+    // Rec. 709 luminance of a linear color.
+    return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+}
+
+inline void color_to_bytes(color pixel_color, int samples_per_pixel, unsigned char rgb[3])
 {
     auto r = pixel_color.x;
     auto g = pixel_color.y;
@@ -26,9 +32,16 @@ inline void write_color(std::ostream &out, color pixel_color, int samples_per_pi
     g = linear_to_gamma(g);
     b = linear_to_gamma(b);
 
-    // Write the translated [0, 255] value of each color component
+    // Translate to [0, 255]
     static const interval intensity(0.000, 0.999);
-    out << static_cast<int>(256 * intensity.clamp(r)) << ' '
-        << static_cast<int>(256 * intensity.clamp(g)) << ' '
-        << static_cast<int>(256 * intensity.clamp(b)) << '\n';
-}
\ No newline at end of file
+    rgb[0] = static_cast<unsigned char>(256 * intensity.clamp(r));
+    rgb[1] = static_cast<unsigned char>(256 * intensity.clamp(g));
+    rgb[2] = static_cast<unsigned char>(256 * intensity.clamp(b));
+}
+
+inline void write_color(std::ostream &out, color pixel_color, int samples_per_pixel)
+{
+    unsigned char rgb[3];
+    color_to_bytes(pixel_color, samples_per_pixel, rgb);
+    out << static_cast<int>(rgb[0]) << ' ' << static_cast<int>(rgb[1]) << ' ' << static_cast<int>(rgb[2]) << '\n';
+}
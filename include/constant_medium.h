@@ -25,36 +25,20 @@ public:
         const bool enableDebug = false;
         const bool debugging = enableDebug && random_double() < 0.00001;
 
-        hit_record rec1, rec2;
-
-        if (!boundary->hit(r, interval(-infinity, +infinity), rec1))
-            return false;
-
-        if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2))
+        if (!inside_boundary(r, ray_t))
             return false;
 
         if (debugging)
-            std::clog << "\nray_tmin=" << rec1.t << ", ray_tmax=" << rec2.t << '\n';
-
-        if (rec1.t < ray_t.min)
-            rec1.t = ray_t.min;
-        if (rec2.t > ray_t.max)
-            rec2.t = ray_t.max;
-
-        if (rec1.t >= rec2.t)
-            return false;
-
-        if (rec1.t < 0)
-            rec1.t = 0;
+            std::clog << "\nray_tmin=" << ray_t.min << ", ray_tmax=" << ray_t.max << '\n';
 
         auto ray_length = r.direction().length();
-        auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        auto hit_distance = neg_inv_density * log(random_double());
+        auto distance_inside_boundary = ray_t.size() * ray_length;
+        auto hit_distance = neg_inv_density * log(sample_random());
 
         if (hit_distance > distance_inside_boundary)
             return false;
 
-        rec.t = rec1.t + hit_distance / ray_length;
+        rec.t = ray_t.min + hit_distance / ray_length;
         rec.p = r.at(rec.t);
 
         if (debugging)
@@ -66,15 +50,52 @@ public:
 
         rec.normal = vec3(1, 0, 0); // arbitrary
         rec.front_face = true;      // also arbitrary
+        rec.du = rec.dv = 0;
         rec.mat = phase_function;
+        rec.primitive_id = id;
 
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t, double &transmittance) const override
+    {
+        // Uniform density attenuates exactly: exp(-density * distance).
+        if (inside_boundary(r, ray_t))
+            transmittance *= exp(ray_t.size() * r.direction().length() / neg_inv_density);
+        return false;
+    }
+
     aabb bounding_box() const override { return boundary->bounding_box(); }
 
+    aabb bounding_box_at(double time) const override { return boundary->bounding_box_at(time); }
+
+    void refit() override { boundary->refit(); }
+
 private:
     shared_ptr<hittable> boundary;
     double neg_inv_density;
     shared_ptr<material> phase_function;
+
+    bool inside_boundary(const ray &r, interval &ray_t) const
+    {
+        // Narrows ray_t to where the ray is inside the (convex) boundary; false if nowhere.
+        // Entry and exit come from one traversal of the boundary.
+        interval inside = empty;
+        if (!boundary->hit_interval(r, inside))
+            return false;
+
+        if (inside.min < ray_t.min)
+            inside.min = ray_t.min;
+        if (inside.max > ray_t.max)
+            inside.max = ray_t.max;
+
+        if (inside.min >= inside.max)
+            return false;
+
+        if (inside.min < 0)
+            inside.min = 0;
+
+        ray_t = inside;
+        return true;
+    }
 };
\ No newline at end of file
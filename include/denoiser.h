@@ -0,0 +1,191 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "parallel.h"
+#include "timing.h"
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// What the camera records about the first surface a camera ray hits, averaged over a pixel's
+// samples to guide the denoiser.
+struct feature_sample
+{
+    color albedo;                  // Surface albedo (the background color for rays that miss)
+    vec3 normal;                   // Shading normal (zero for rays that miss)
+    double depth = 0;              // Distance from the camera (zero for rays that miss)
+    unsigned int primitive_id = 0; // hittable::object_id() of the hit primitive (zero for a miss)
+    unsigned int material_id = 0;  // material::material_id() of the hit (zero for a miss)
+};
+
+class denoiser
+{
+public:
+    int iterations = 5;           // à-trous 迭代次数（第 i 次的采样间距为 2^i 像素）
+    double sigma_luminance = 4.0; // 亮度权重容差（以亮度标准差为单位）
+    double sigma_normal = 128.0;  // 法线权重的指数
+    double sigma_depth = 1.0;     // 深度权重容差（以局部深度梯度为单位）
+
+    // Albedo below this is treated as black and left out of demodulation.
+    static color demodulation_albedo(const color &albedo)
+    {
+        return color(albedo.x > 0.01f ? albedo.x : 1.0f, albedo.y > 0.01f ? albedo.y : 1.0f,
+                     albedo.z > 0.01f ? albedo.z : 1.0f);
+    }
+
+    static double luminance(const color &c) { return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z; }
+
+    std::vector<color> apply(int width, int height, std::vector<color> illumination, std::vector<double> variance,
+                             const std::vector<color> &albedo, std::vector<vec3> normal,
+                             const std::vector<double> &depth) const
+    {
+        // Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) with variance-guided
+        // luminance weights (Schied et al. 2017). The input is the per-pixel mean of the
+        // illumination, i.e. radiance divided by albedo, so texture detail never gets blurred.
+        // Also passed in are the variance of that mean's luminance and the averaged
+        // first-hit features. Returns the filtered radiance with albedo multiplied back in.
+        auto pixels = static_cast<size_t>(width) * height;
+
+        // Averaged normals are shorter than unit length where samples disagree; renormalize,
+        // and treat pixels whose samples mostly missed (or cancel out) as having none.
+        for (auto &n : normal)
+            n = (n.length_squared() > 1e-4f) ? n.normalized() : vec3(0, 0, 0);
+
+        std::vector<double> depth_dx(pixels), depth_dy(pixels);
+        depth_gradients(width, height, depth, depth_dx, depth_dy);
+
+        std::vector<color> next_illumination(pixels);
+        std::vector<double> next_variance(pixels), blurred_variance(pixels);
+
+        for (int iteration = 0; iteration < iterations; iteration++)
+        {
+            int step = 1 << iteration;
+            auto pass_start = std::chrono::steady_clock::now();
+            blur_variance(width, height, variance, blurred_variance);
+
+            parallel_for(0, height, 8, [&](size_t row_begin, size_t row_end)
+                         {
+                for (auto y = static_cast<int>(row_begin); y < static_cast<int>(row_end); y++)
+                    for (int x = 0; x < width; x++)
+                        filter_pixel(width, height, x, y, step, illumination, variance, blurred_variance, normal, depth,
+                                     depth_dx, depth_dy, next_illumination, next_variance); });
+
+            illumination.swap(next_illumination);
+            variance.swap(next_variance);
+            trace_recorder::global().record("atrous pass", "denoise", pass_start, std::chrono::steady_clock::now(),
+                                            "\"step\": " + std::to_string(step));
+        }
+
+        for (size_t p = 0; p < pixels; p++)
+            illumination[p] = illumination[p] * demodulation_albedo(albedo[p]);
+        return illumination;
+    }
+
+private:
+    void filter_pixel(int width, int height, int x, int y, int step, const std::vector<color> &illumination,
+                      const std::vector<double> &variance, const std::vector<double> &blurred_variance,
+                      const std::vector<vec3> &normal, const std::vector<double> &depth,
+                      const std::vector<double> &depth_dx, const std::vector<double> &depth_dy,
+                      std::vector<color> &out_illumination, std::vector<double> &out_variance) const
+    {
+        static const double kernel[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+
+        auto p = static_cast<size_t>(y) * width + x;
+        auto luminance_p = luminance(illumination[p]);
+        auto luminance_scale = sigma_luminance * std::sqrt(std::fmax(blurred_variance[p], 0.0)) + 1e-10;
+        auto normal_p = normal[p];
+        auto has_normal_p = dot(normal_p, normal_p) > 0.5f;
+
+        color sum(0, 0, 0);
+        double weight_sum = 0, variance_sum = 0;
+
+        for (int dy = -2; dy <= 2; dy++)
+        {
+            auto qy = y + dy * step;
+            if (qy < 0 || qy >= height)
+                continue;
+
+            for (int dx = -2; dx <= 2; dx++)
+            {
+                auto qx = x + dx * step;
+                if (qx < 0 || qx >= width)
+                    continue;
+
+                auto q = static_cast<size_t>(qy) * width + qx;
+                if (q == p)
+                {
+                    auto w = kernel[2] * kernel[2];
+                    sum += w * illumination[p];
+                    variance_sum += w * w * variance[p];
+                    weight_sum += w;
+                    continue;
+                }
+
+                // Edge-stopping weights: luminance relative to the noise level, normal
+                // similarity, and depth relative to what the local slope predicts.
+                auto w_luminance = std::exp(-std::fabs(luminance_p - luminance(illumination[q])) / luminance_scale);
+
+                auto has_normal_q = dot(normal[q], normal[q]) > 0.5f;
+                auto w_normal = 1.0;
+                if (has_normal_p || has_normal_q)
+                    w_normal = std::pow(std::fmax(0.0, static_cast<double>(dot(normal_p, normal[q]))), sigma_normal);
+
+                auto expected = std::fabs(depth_dx[p] * dx * step + depth_dy[p] * dy * step);
+                auto w_depth = std::exp(-std::fabs(depth[p] - depth[q]) / (sigma_depth * expected + 1e-3));
+
+                auto w = kernel[dx + 2] * kernel[dy + 2] * w_luminance * w_normal * w_depth;
+                sum += w * illumination[q];
+                variance_sum += w * w * variance[q];
+                weight_sum += w;
+            }
+        }
+
+        // The center tap always counts with weight kernel[2]^2, so weight_sum is never zero.
+        out_illumination[p] = sum / weight_sum;
+        out_variance[p] = variance_sum / (weight_sum * weight_sum);
+    }
+
+    static void depth_gradients(int width, int height, const std::vector<double> &depth,
+                                std::vector<double> &dx, std::vector<double> &dy)
+    {
+        // Per-pixel depth slope, taking the smaller one-sided difference so that a silhouette
+        // does not make its neighbours look steep.
+        auto smaller = [](double a, double b) { return (std::fabs(a) < std::fabs(b)) ? a : b; };
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                auto p = static_cast<size_t>(y) * width + x;
+                auto left = (x > 0) ? depth[p] - depth[p - 1] : infinity;
+                auto right = (x + 1 < width) ? depth[p + 1] - depth[p] : infinity;
+                auto up = (y > 0) ? depth[p] - depth[p - width] : infinity;
+                auto down = (y + 1 < height) ? depth[p + width] - depth[p] : infinity;
+                dx[p] = (width > 1) ? smaller(left, right) : 0;
+                dy[p] = (height > 1) ? smaller(up, down) : 0;
+            }
+    }
+
+    static void blur_variance(int width, int height, const std::vector<double> &variance, std::vector<double> &out)
+    {
+        // 3x3 Gaussian prefilter, so the luminance weights are not driven by a noisy variance.
+        static const double kernel[3] = {0.25, 0.5, 0.25};
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+            {
+                double sum = 0, weight_sum = 0;
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        auto qx = x + dx, qy = y + dy;
+                        if (qx < 0 || qx >= width || qy < 0 || qy >= height)
+                            continue;
+                        auto w = kernel[dx + 1] * kernel[dy + 1];
+                        sum += w * variance[static_cast<size_t>(qy) * width + qx];
+                        weight_sum += w;
+                    }
+                out[static_cast<size_t>(y) * width + x] = sum / weight_sum;
+            }
+    }
+};
@@ -0,0 +1,412 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "net.h"
+#include "scene_file.h"
+#include "scenes.h"
+#include "timing.h"
+
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Rendering one image across processes. A coordinator cuts the image into tiles and each
+// pixel's samples into ranges, hands the (tile, range) jobs to whichever workers are idle,
+// and adds the radiance sums they send back into one buffer. Every sample index draws the
+// same sampler numbers wherever it runs, so the merged image is the one a single process
+// would have made (except with sampler_type::independent, which draws random_double()). A
+// worker that disconnects or stalls loses its job to the others.
+//
+// Protocol, one text line per message:
+//   coordinator -> worker   job <id> <scene> <seed> <width> <spp> <depth> <x0> <y0> <x1> <y1> <first> <count>
+//                           quit
+//   worker -> coordinator   result <id>, then 3 floats (native byte order) per pixel, row by row
+//                           error <message>
+// <scene> is written with std::quoted, so a scene file path may contain spaces.
+
+struct render_settings
+{
+    std::string scene;     // 场景目录中的名字，或 .scene 场景文件的路径
+    unsigned int seed = 0; // 构建场景前的随机数种子（各进程须一致）
+    int image_width = 0;   // 图像宽度（0 表示使用场景默认值）
+    int samples_per_pixel = 0; // 每像素采样数（0 表示使用场景默认值）
+    int max_depth = 0;         // 最大反弹次数（0 表示使用场景默认值）
+};
+
+// Builds a catalog scene, or loads a scene file (a name ending in .scene), the same way in
+// every process and applies the settings' overrides; settings then hold the values actually
+// used. False if there is no such scene.
+inline bool build_scene(render_settings &settings, scene &s)
+{
+    auto &name = settings.scene;
+    bool found = false;
+    if (name.size() > 6 && name.compare(name.size() - 6, 6, ".scene") == 0)
+    {
+        seed_random(settings.seed); // As for catalog scenes: loading may draw random numbers
+        if (!load_scene(name, s))
+            return false;
+        found = true;
+    }
+
+    for (const auto &entry : scene_catalog())
+    {
+        if (found || name != entry.name)
+            continue;
+        seed_random(settings.seed);
+        s = entry.build();
+        found = true;
+    }
+
+    if (!found)
+    {
+        std::cerr << "ERROR: Unknown scene '" << name << "'.\n";
+        return false;
+    }
+
+    if (settings.image_width > 0)
+        s.cam.image_width = settings.image_width;
+    if (settings.samples_per_pixel > 0)
+        s.cam.samples_per_pixel = settings.samples_per_pixel;
+    if (settings.max_depth > 0)
+        s.cam.max_depth = settings.max_depth;
+    settings.image_width = s.cam.image_width;
+    settings.samples_per_pixel = s.cam.samples_per_pixel;
+    settings.max_depth = s.cam.max_depth;
+    return true;
+}
+
+struct render_job
+{
+    int x0, y0, x1, y1;     // Pixel rectangle [x0,x1) x [y0,y1)
+    int first_sample, sample_count;
+
+    size_t pixels() const { return static_cast<size_t>(x1 - x0) * (y1 - y0); }
+};
+
+inline int run_worker(const std::string &host, int port, int threads)
+{
+    // Renders jobs until the coordinator says quit or goes away. The scene of the last job is
+    // kept, so a run costs one scene build per worker.
+    auto link = connect_tcp(host, port);
+    if (!link.is_open())
+        return 1;
+
+    std::string cached_key;
+    scene cached;
+    std::string line;
+    while (link.read_line(line))
+    {
+        std::istringstream in(line);
+        std::string command;
+        in >> command;
+        if (command == "quit")
+            return 0;
+
+        long id;
+        render_settings settings;
+        render_job job;
+        if (command != "job" ||
+            !(in >> id >> std::quoted(settings.scene) >> settings.seed >> settings.image_width >> settings.samples_per_pixel >>
+              settings.max_depth >> job.x0 >> job.y0 >> job.x1 >> job.y1 >> job.first_sample >> job.sample_count))
+        {
+            link.send_line("error malformed request: " + line);
+            return 1;
+        }
+
+        auto key = settings.scene + ' ' + std::to_string(settings.seed) + ' ' + std::to_string(settings.image_width) +
+                   ' ' + std::to_string(settings.samples_per_pixel) + ' ' + std::to_string(settings.max_depth);
+        if (key != cached_key)
+        {
+            cached_key.clear();
+            if (!build_scene(settings, cached))
+            {
+                link.send_line("error unknown scene " + settings.scene);
+                return 1;
+            }
+            cached_key = key;
+        }
+
+        cached.cam.thread_count = threads;
+        cached.cam.show_progress = false;
+        auto sums = cached.cam.render_region(cached.world, job.x0, job.y0, job.x1, job.y1, job.first_sample,
+                                             job.sample_count);
+
+        std::vector<float> values;
+        values.reserve(3 * sums.size());
+        for (const auto &c : sums)
+            values.insert(values.end(), {c.x, c.y, c.z});
+        if (!link.send_line("result " + std::to_string(id)) ||
+            !link.send_all(values.data(), values.size() * sizeof(float)))
+            return 1;
+    }
+    return 0;
+}
+
+struct coordinator_options
+{
+    render_settings settings;
+    int port = 0;           // 监听端口（0 表示任选空闲端口）
+    int spawn = 0;          // 在本机派生的工作进程数
+    int worker_threads = 0; // 派生的工作进程各自的线程数（0 表示平分硬件线程）
+    int tile_size = 64;     // 作业图块边长（像素）
+    int job_samples = 0;    // 每个作业的采样数（0 表示 min(每像素采样数, 64)）
+    double timeout = 600;   // 作业超时（秒，0 表示不限）；超时的工作进程被断开，作业重新分配
+    std::string out;        // 输出 PPM 文件（空表示标准输出）
+};
+
+inline int run_coordinator(coordinator_options options)
+{
+    listener server(options.port);
+    if (!server.is_open())
+        return 1;
+    auto port = server.port();
+    std::clog << "Coordinator listening on port " << port << '\n';
+
+    // Local workers are forked before this process starts any threads of its own.
+    std::vector<pid_t> children;
+    if (options.spawn > 0)
+    {
+        auto threads = options.worker_threads > 0
+                           ? options.worker_threads
+                           : std::max(1, static_cast<int>(hardware_threads()) / options.spawn);
+        std::cout.flush();
+        for (int k = 0; k < options.spawn; k++)
+        {
+            auto pid = ::fork();
+            if (pid == 0)
+            {
+                ::close(server.handle());
+                ::_exit(run_worker("localhost", port, threads));
+            }
+            if (pid > 0)
+                children.push_back(pid);
+            else
+                std::cerr << "ERROR: Could not start local worker: " << std::strerror(errno) << ".\n";
+        }
+    }
+
+    auto reap_children = [&]
+    {
+        for (auto pid : children)
+            ::waitpid(pid, nullptr, 0);
+        children.clear();
+    };
+
+    // Forgets the local workers that have exited, without waiting for the others.
+    auto reap_exited_children = [&]
+    {
+        children.erase(std::remove_if(children.begin(), children.end(),
+                                      [](pid_t pid) { return ::waitpid(pid, nullptr, WNOHANG) != 0; }),
+                       children.end());
+    };
+
+    // The coordinator builds the scene too, only to learn the image size and check the name.
+    auto &settings = options.settings;
+    scene s;
+    if (!build_scene(settings, s))
+    {
+        server.close(); // Workers waiting for their first job see the refusal and exit
+        reap_children();
+        return 1;
+    }
+    auto width = settings.image_width;
+    auto height = std::max(1, static_cast<int>(width / s.cam.aspect_ratio)); // As camera::initialize()
+    auto spp = settings.samples_per_pixel;
+    auto tile = std::max(1, options.tile_size);
+    auto chunk = (options.job_samples > 0) ? options.job_samples : std::min(spp, 64);
+
+    // Sample ranges outermost, so an interrupted run has covered the whole image at some rate.
+    std::vector<render_job> jobs;
+    for (int first = 0; first < spp; first += chunk)
+        for (int y0 = 0; y0 < height; y0 += tile)
+            for (int x0 = 0; x0 < width; x0 += tile)
+                jobs.push_back({x0, y0, std::min(x0 + tile, width), std::min(y0 + tile, height), first,
+                                std::min(chunk, spp - first)});
+
+    std::deque<size_t> pending;
+    for (size_t i = 0; i < jobs.size(); i++)
+        pending.push_back(i);
+    std::vector<char> finished(jobs.size(), 0);
+    auto remaining = jobs.size();
+
+    std::vector<color> sums(static_cast<size_t>(width) * height);
+    std::vector<int> counts(sums.size(), 0);
+
+    struct worker_link
+    {
+        connection link;
+        long job = -1;       // Index of the job it is rendering, -1 if idle
+        bool header = false; // The job's result line has arrived, its pixels not yet
+        std::chrono::steady_clock::time_point started{}; // When the job was sent
+    };
+    std::vector<worker_link> workers;
+
+    auto drop = [&](worker_link &w, const char *reason)
+    {
+        std::cerr << "\nWARNING: Worker lost (" << reason << ")";
+        if (w.job >= 0)
+        {
+            std::cerr << "; job " << w.job << " goes back in the queue";
+            pending.push_front(static_cast<size_t>(w.job));
+        }
+        std::cerr << ".\n";
+        w.job = -1;
+        w.link.close();
+    };
+
+    progress_reporter progress(std::clog, static_cast<std::uint64_t>(width) * height * spp, 1.0);
+    auto timeout = std::chrono::duration<double>(options.timeout);
+    bool failed = false;
+    std::string worker_error; // The last error a worker reported
+    std::vector<float> values;
+
+    while (remaining > 0 && !failed)
+    {
+        for (auto &w : workers)
+        {
+            if (w.job >= 0 || pending.empty())
+                continue;
+            auto i = pending.front();
+            pending.pop_front();
+            auto &job = jobs[i];
+            w.job = static_cast<long>(i);
+            w.header = false;
+            w.started = std::chrono::steady_clock::now();
+            std::ostringstream request;
+            request << "job " << i << ' ' << std::quoted(settings.scene) << ' ' << settings.seed << ' '
+                    << settings.image_width << ' ' << settings.samples_per_pixel << ' ' << settings.max_depth << ' '
+                    << job.x0 << ' ' << job.y0 << ' ' << job.x1 << ' ' << job.y1 << ' ' << job.first_sample << ' '
+                    << job.sample_count;
+            if (!w.link.send_line(request.str()))
+                drop(w, "send failed");
+        }
+
+        std::vector<pollfd> fds(1 + workers.size());
+        fds[0].fd = server.handle();
+        for (size_t k = 0; k < workers.size(); k++)
+            fds[k + 1].fd = workers[k].link.handle();
+        wait_readable(fds.data(), fds.size(), 1000);
+
+        for (size_t k = 0; k < workers.size(); k++)
+        {
+            auto &w = workers[k];
+            if (!w.link.is_open())
+                continue;
+            if (fds[k + 1].revents && !w.link.receive())
+            {
+                drop(w, "disconnected");
+                continue;
+            }
+
+            std::string line;
+            while (w.job >= 0)
+            {
+                auto &job = jobs[static_cast<size_t>(w.job)];
+                if (!w.header)
+                {
+                    if (!w.link.take_line(line))
+                        break;
+                    if (line.rfind("error ", 0) == 0)
+                    {
+                        // The scene built here, so the fault is that worker's (a remote machine
+                        // without the scene file, say); the others can take its job.
+                        worker_error = line.substr(6);
+                        drop(w, ("error: " + worker_error).c_str());
+                        break;
+                    }
+                    if (line != "result " + std::to_string(w.job))
+                    {
+                        drop(w, "unexpected reply");
+                        break;
+                    }
+                    w.header = true;
+                }
+
+                values.resize(3 * job.pixels());
+                if (!w.link.take_bytes(values.data(), values.size() * sizeof(float)))
+                    break;
+
+                auto i = static_cast<size_t>(w.job);
+                if (!finished[i])
+                {
+                    finished[i] = 1;
+                    remaining--;
+                    size_t v = 0;
+                    for (int y = job.y0; y < job.y1; y++)
+                        for (int x = job.x0; x < job.x1; x++, v += 3)
+                        {
+                            auto p = static_cast<size_t>(y) * width + x;
+                            sums[p] += color(values[v], values[v + 1], values[v + 2]);
+                            counts[p] += job.sample_count;
+                        }
+                    progress.advance(job.pixels() * job.sample_count);
+                }
+                w.job = -1;
+            }
+
+            if (w.job >= 0 && options.timeout > 0 && std::chrono::steady_clock::now() - w.started > timeout)
+                drop(w, "timed out");
+        }
+
+        workers.erase(std::remove_if(workers.begin(), workers.end(),
+                                     [](const worker_link &w) { return !w.link.is_open(); }),
+                      workers.end());
+
+        if (fds[0].revents)
+        {
+            auto link = server.accept();
+            if (link.is_open())
+                workers.push_back({std::move(link)});
+        }
+
+        // With no workers left to take the jobs the loop would poll forever. Spawned workers
+        // are gone once their processes have exited. Without --spawn, remote workers may still
+        // connect, unless the ones that did have failed.
+        if (options.spawn > 0)
+            reap_exited_children();
+        if (workers.empty() && (options.spawn > 0 ? children.empty() : !worker_error.empty()))
+        {
+            std::cerr << "\nERROR: No workers left with " << remaining << " jobs to do";
+            if (!worker_error.empty())
+                std::cerr << "; the last one failed: " << worker_error;
+            std::cerr << ".\n";
+            failed = true;
+        }
+    }
+
+    // Workers still waiting in the listen queue are never accepted; closing the listener
+    // refuses them, so they exit rather than wait for a job, and the reaping below returns.
+    server.close();
+    for (auto &w : workers)
+        w.link.send_line("quit");
+    workers.clear();
+    reap_children();
+    if (failed)
+        return 1;
+    progress.finish();
+
+    std::ofstream file;
+    if (!options.out.empty())
+    {
+        file.open(options.out);
+        if (!file)
+        {
+            std::cerr << "ERROR: Could not write image to '" << options.out << "'.\n";
+            return 1;
+        }
+    }
+    auto &out = options.out.empty() ? std::cout : file;
+    out << "P3\n"
+        << width << ' ' << height << "\n255\n";
+    for (size_t p = 0; p < sums.size(); p++)
+        write_color(out, sums[p], counts[p]);
+    return 0;
+}
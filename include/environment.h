@@ -0,0 +1,132 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "rtw_std_image.h"
+#include "sampling.h"
+
+#include <cmath>
+#include <vector>
+
+class environment_light
+{
+public:
+    // Radiance arriving from infinitely far away, stored as a latitude-longitude image: x
+    // runs once around the +y axis, y from straight up (row 0) to straight down. Directions
+    // can be drawn in proportion to the radiance, so a small bright sun is found by a few
+    // samples instead of by chance.
+    environment_light(const char *filename, float intensity = 1.0f) : intensity(intensity)
+    {
+        rtw_image image(filename);
+        if (image.width() == 0)
+        {
+            // Keep the light usable: a dim grey sky instead of nothing.
+            build(1, 1, {color(0.5, 0.5, 0.5)});
+            return;
+        }
+        if (!image.is_hdr())
+            std::cerr << "WARNING: Environment map '" << filename
+                      << "' is not high dynamic range; treating its 8-bit values as linear.\n";
+
+        std::vector<color> pixels(static_cast<size_t>(image.width()) * image.height());
+        for (int y = 0; y < image.height(); y++)
+        {
+            for (int x = 0; x < image.width(); x++)
+            {
+                auto &p = pixels[static_cast<size_t>(y) * image.width() + x];
+                if (image.is_hdr())
+                {
+                    auto texel = image.hdr_pixel_data(x, y);
+                    p = color(texel[0], texel[1], texel[2]);
+                }
+                else
+                {
+                    auto texel = image.pixel_data(x, y);
+                    p = color(texel[0] / 255.0, texel[1] / 255.0, texel[2] / 255.0);
+                }
+            }
+        }
+        build(image.width(), image.height(), std::move(pixels));
+    }
+
+    // From linear pixels in memory, laid out as above (row major).
+    environment_light(int width, int height, std::vector<color> pixels, float intensity = 1.0f)
+        : intensity(intensity)
+    {
+        build(width, height, std::move(pixels));
+    }
+
+    color value(const vec3 &direction) const
+    {
+        // Radiance arriving along -direction, i.e. seen when looking along direction.
+        double u, v;
+        direction_to_uv(direction, u, v);
+        return intensity * texel(u, v);
+    }
+
+    vec3 sample(const sample2d &s, double &pdf) const
+    {
+        // Draws a unit direction in proportion to radiance times the solid angle of its
+        // texel; pdf receives the density per solid angle.
+        double image_pdf;
+        auto uv = distribution.sample(s, image_pdf);
+        auto theta = uv.v * pi;
+        auto phi = uv.u * 2 * pi;
+        auto sin_theta = std::sin(theta);
+        pdf = (sin_theta > 0) ? image_pdf / (2 * pi * pi * sin_theta) : 0;
+        return vec3(-std::cos(phi) * sin_theta, std::cos(theta), std::sin(phi) * sin_theta);
+    }
+
+    double pdf(const vec3 &direction) const
+    {
+        double u, v;
+        direction_to_uv(direction, u, v);
+        auto sin_theta = std::sin(v * pi);
+        return (sin_theta > 0) ? distribution.density(u, v) / (2 * pi * pi * sin_theta) : 0;
+    }
+
+private:
+    int width = 0, height = 0;
+    std::vector<color> pixels;
+    piecewise_constant_2d distribution;
+    float intensity;
+
+    void build(int w, int h, std::vector<color> p)
+    {
+        width = w;
+        height = h;
+        pixels = std::move(p);
+
+        // Weight each texel by its luminance and by the solid angle it covers, which shrinks
+        // towards the poles as sin(theta).
+        std::vector<double> weights(pixels.size());
+        for (int y = 0; y < height; y++)
+        {
+            auto sin_theta = std::sin(pi * (y + 0.5) / height);
+            for (int x = 0; x < width; x++)
+            {
+                auto &c = pixels[static_cast<size_t>(y) * width + x];
+                weights[static_cast<size_t>(y) * width + x] = luminance(c) * sin_theta;
+            }
+        }
+        distribution = piecewise_constant_2d(weights, width, height);
+    }
+
+    color texel(double u, double v) const
+    {
+        // Nearest texel, so that the radiance is constant wherever the sampling density is.
+        auto x = std::min(static_cast<int>(u * width), width - 1);
+        auto y = std::min(static_cast<int>(v * height), height - 1);
+        return pixels[static_cast<size_t>(std::max(y, 0)) * width + std::max(x, 0)];
+    }
+
+    static void direction_to_uv(const vec3 &direction, double &u, double &v)
+    {
+        // The same mapping as sphere::get_sphere_uv, with v measured from +y down.
+        auto d = direction.normalized();
+        auto theta = std::acos(std::fmax(-1.0, std::fmin(1.0, static_cast<double>(d.y))));
+        auto phi = std::atan2(-d.z, d.x) + pi;
+        u = phi / (2 * pi);
+        v = theta / pi;
+    }
+};
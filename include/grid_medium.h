@@ -0,0 +1,276 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "parallel.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class density_grid
+{
+public:
+    // Extinction density sampled at the corners of nx x ny x nz cells spanning bounds, and
+    // interpolated trilinearly in between. Zero outside the bounds.
+    density_grid(const aabb &bounds, int nx, int ny, int nz, std::vector<float> values)
+        : box(bounds), values(std::move(values))
+    {
+        res[0] = nx;
+        res[1] = ny;
+        res[2] = nz;
+    }
+
+    // Samples a texture's luminance, times scale, on a resolution^3 grid over bounds.
+    density_grid(const aabb &bounds, const texture &tex, double scale, int resolution = 64)
+        : box(bounds), values(static_cast<size_t>(resolution) * resolution * resolution)
+    {
+        res[0] = res[1] = res[2] = resolution;
+        parallel_for(0, resolution, 1, [&](size_t z0, size_t z1)
+                     {
+            for (auto k = z0; k < z1; k++)
+                for (int j = 0; j < resolution; j++)
+                    for (int i = 0; i < resolution; i++)
+                    {
+                        auto p = corner(i, j, static_cast<int>(k));
+                        values[index(i, j, static_cast<int>(k))] =
+                            static_cast<float>(std::fmax(0.0, scale * luminance(tex.value(0, 0, p))));
+                    } });
+    }
+
+    const aabb &bounds() const { return box; }
+    int resolution(int axis) const { return res[axis]; }
+
+    double density(const point3 &p) const
+    {
+        double g[3];
+        int c[3];
+        for (int a = 0; a < 3; a++)
+        {
+            auto &span = box.axis(a);
+            g[a] = (p[a] - span.min) / span.size() * (res[a] - 1);
+            if (g[a] < 0 || g[a] > res[a] - 1)
+                return 0;
+            c[a] = std::min(static_cast<int>(g[a]), res[a] - 2);
+            g[a] -= c[a];
+        }
+
+        double d = 0;
+        for (int k = 0; k < 2; k++)
+            for (int j = 0; j < 2; j++)
+                for (int i = 0; i < 2; i++)
+                    d += (i ? g[0] : 1 - g[0]) * (j ? g[1] : 1 - g[1]) * (k ? g[2] : 1 - g[2]) *
+                         values[index(c[0] + i, c[1] + j, c[2] + k)];
+        return d;
+    }
+
+    double max_density(const aabb &region) const
+    {
+        // Largest density anywhere in region: trilinear interpolation never exceeds the
+        // corner values of the cells it blends, so the max over those corners bounds it.
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++)
+        {
+            auto &span = box.axis(a);
+            auto scale = (res[a] - 1) / span.size();
+            lo[a] = std::clamp(static_cast<int>(std::floor((region.axis(a).min - span.min) * scale)), 0, res[a] - 1);
+            hi[a] = std::clamp(static_cast<int>(std::ceil((region.axis(a).max - span.min) * scale)), 0, res[a] - 1);
+        }
+
+        float m = 0;
+        for (int k = lo[2]; k <= hi[2]; k++)
+            for (int j = lo[1]; j <= hi[1]; j++)
+                for (int i = lo[0]; i <= hi[0]; i++)
+                    m = std::max(m, values[index(i, j, k)]);
+        return m;
+    }
+
+private:
+    aabb box;
+    int res[3];
+    std::vector<float> values; // x fastest, then y, then z
+
+    size_t index(int i, int j, int k) const
+    {
+        return (static_cast<size_t>(k) * res[1] + j) * res[0] + i;
+    }
+
+    point3 corner(int i, int j, int k) const
+    {
+        return point3(box.x.min + box.x.size() * i / (res[0] - 1), box.y.min + box.y.size() * j / (res[1] - 1),
+                      box.z.min + box.z.size() * k / (res[2] - 1));
+    }
+};
+
+class grid_medium : public hittable
+{
+public:
+    // A participating medium whose density varies through a grid: smoke, clouds. Scattering
+    // is found by delta tracking and shadow rays are attenuated by ratio tracking, both
+    // against a coarse grid of majorants (the highest density in each of its cells), so
+    // thin and empty regions are crossed in a few long steps rather than marched through.
+    grid_medium(shared_ptr<density_grid> density, color albedo, int majorant_resolution = 16)
+        : density(density), phase_function(make_shared<isotropic>(albedo))
+    {
+        auto bounds = density->bounds();
+        box = bounds.pad();
+        for (int a = 0; a < 3; a++)
+            cells[a] = std::max(1, std::min(majorant_resolution, density->resolution(a) - 1));
+
+        majorants.resize(static_cast<size_t>(cells[0]) * cells[1] * cells[2]);
+        for (int k = 0; k < cells[2]; k++)
+            for (int j = 0; j < cells[1]; j++)
+                for (int i = 0; i < cells[0]; i++)
+                    majorants[cell_index(i, j, k)] = density->max_density(cell_bounds(i, j, k));
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        // Delta tracking: tentative collisions at the majorant rate, each real with probability
+        // density / majorant. The first real one is where the ray scatters.
+        double t_hit = 0;
+        auto found = track(r, ray_t, [&](double t, double sigma, double majorant)
+                           {
+                               if (sample_random() * majorant >= sigma)
+                                   return true; // Null collision: keep going
+                               t_hit = t;
+                               return false; });
+        if (!found)
+            return false;
+
+        rec.t = t_hit;
+        rec.p = r.at(t_hit);
+        rec.normal = vec3(1, 0, 0); // arbitrary
+        rec.front_face = true;      // also arbitrary
+        rec.u = rec.v = 0;
+        rec.du = rec.dv = 0;
+        rec.mat = phase_function;
+        rec.primitive_id = id;
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t, double &transmittance) const override
+    {
+        // Ratio tracking: every tentative collision scales the estimate by the chance it was
+        // a null one. Russian roulette ends walks whose estimate has become negligible.
+        double t_r = transmittance;
+        track(r, ray_t, [&](double, double sigma, double majorant)
+              {
+                  t_r *= 1 - sigma / majorant;
+                  if (t_r < 0.05)
+                  {
+                      if (sample_random() < 0.5)
+                      {
+                          t_r = 0;
+                          return false;
+                      }
+                      t_r *= 2;
+                  }
+                  return true; });
+        transmittance = t_r;
+        return transmittance <= 0;
+    }
+
+    aabb bounding_box() const override { return box; }
+
+private:
+    shared_ptr<density_grid> density;
+    shared_ptr<material> phase_function;
+    aabb box;
+    int cells[3];
+    std::vector<double> majorants;
+
+    size_t cell_index(int i, int j, int k) const
+    {
+        return (static_cast<size_t>(k) * cells[1] + j) * cells[0] + i;
+    }
+
+    aabb cell_bounds(int i, int j, int k) const
+    {
+        int c[3] = {i, j, k};
+        interval spans[3];
+        for (int a = 0; a < 3; a++)
+        {
+            auto &span = density->bounds().axis(a);
+            auto size = span.size() / cells[a];
+            spans[a] = interval(span.min + c[a] * size, span.min + (c[a] + 1) * size);
+        }
+        return aabb(spans[0], spans[1], spans[2]);
+    }
+
+    template <typename Collision>
+    bool track(const ray &r, interval ray_t, Collision collision) const
+    {
+        // Walks the majorant cells the ray crosses inside ray_t (3D DDA) and draws tentative
+        // collisions at each cell's majorant rate. collision(t, density, majorant) returns
+        // false to stop; track() then returns true. Returns false if the ray got through.
+        if (!density->bounds().clip(r, ray_t))
+            return false;
+
+        auto &bounds = density->bounds();
+        auto ray_length = r.direction().length();
+        auto entry = r.at(ray_t.min);
+
+        int cell[3], step[3], end[3];
+        double t_next[3], t_delta[3];
+        for (int a = 0; a < 3; a++)
+        {
+            auto &span = bounds.axis(a);
+            auto size = span.size() / cells[a];
+            auto dir = r.direction()[a];
+            cell[a] = std::clamp(static_cast<int>((entry[a] - span.min) / size), 0, cells[a] - 1);
+            if (dir > 0)
+            {
+                step[a] = 1;
+                end[a] = cells[a];
+                t_next[a] = (span.min + (cell[a] + 1) * size - r.origin()[a]) / dir;
+                t_delta[a] = size / dir;
+            }
+            else if (dir < 0)
+            {
+                step[a] = -1;
+                end[a] = -1;
+                t_next[a] = (span.min + cell[a] * size - r.origin()[a]) / dir;
+                t_delta[a] = -size / dir;
+            }
+            else
+            {
+                step[a] = 0;
+                end[a] = -1;
+                t_next[a] = t_delta[a] = infinity;
+            }
+        }
+
+        auto t = ray_t.min;
+        while (t < ray_t.max)
+        {
+            auto axis = (t_next[0] < t_next[1]) ? ((t_next[0] < t_next[2]) ? 0 : 2) : ((t_next[1] < t_next[2]) ? 1 : 2);
+            auto t_exit = std::fmin(t_next[axis], ray_t.max);
+            auto majorant = majorants[cell_index(cell[0], cell[1], cell[2])];
+
+            if (majorant > 0)
+            {
+                // Distances along the ray are in units of the direction's length.
+                auto rate = majorant * ray_length;
+                while (true)
+                {
+                    t -= std::log(1 - sample_random()) / rate;
+                    if (t >= t_exit)
+                        break;
+                    if (!collision(t, density->density(r.at(t)), majorant))
+                        return true;
+                }
+            }
+
+            t = t_exit;
+            cell[axis] += step[axis];
+            if (cell[axis] == end[axis])
+                break;
+            t_next[axis] += t_delta[axis];
+        }
+        return false;
+    }
+};
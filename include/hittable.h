@@ -2,6 +2,10 @@
 
 #include "rtweekend.h"
 #include "aabb.h"
+#include "sampling.h"
+#include "stats.h"
+
+#include <vector>
 
 class material;
 
@@ -13,6 +17,8 @@ public:
     shared_ptr<material> mat;
     double t;
     double u, v;
+    double du = 0, dv = 0; // 单个采样在纹理 u、v 方向上覆盖的宽度
+    unsigned int primitive_id = 0; // 命中图元的编号（0 表示没有图元）
     bool front_face;
 
     void set_face_normal(const ray &r, const vec3 &outward_normal)
@@ -22,14 +28,94 @@ public:
         // 如果小于零表示ray从外部进入球体
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    void set_uv_footprint(const ray &r, const vec3 &dpdu, const vec3 &dpdv)
+    {
+        // Intersect the ray's differentials with the tangent plane at p, then project the
+        // offsets onto the surface's (u,v) axes. Rays without differentials get 0, which
+        // samples textures at full resolution.
+        du = dv = 0;
+        if (!r.has_differentials())
+            return;
+
+        auto denom_x = dot(normal, r.rx_direction());
+        auto denom_y = dot(normal, r.ry_direction());
+        if (fabs(denom_x) < 1e-12 || fabs(denom_y) < 1e-12)
+            return;
+
+        auto d = dot(normal, p);
+        auto tx = (d - dot(normal, r.rx_origin())) / denom_x;
+        auto ty = (d - dot(normal, r.ry_origin())) / denom_y;
+        vec3 dpdx = r.rx_origin() + tx * r.rx_direction() - p;
+        vec3 dpdy = r.ry_origin() + ty * r.ry_direction() - p;
+
+        du = fmax(fabs(dot(dpdx, dpdu)), fabs(dot(dpdy, dpdu))) / dpdu.length_squared();
+        dv = fmax(fabs(dot(dpdx, dpdv)), fabs(dot(dpdy, dpdv))) / dpdv.length_squared();
+    }
 };
 
 class hittable
 {
 public:
+    hittable() : id(next_id()) {}
     virtual ~hittable() = default;
     virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
     virtual aabb bounding_box() const = 0;
+
+    // Shadow-ray query: true if something opaque lies within ray_t. Participating media let
+    // light through instead, multiplying transmittance by the fraction that passes. Unlike
+    // hit(), any blocker will do, so containers stop at the first they find.
+    virtual bool occluded(const ray &r, interval ray_t, double &transmittance) const
+    {
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    // Bounds of the object at a single ray time in [0,1]. Over that range they must stay inside
+    // the linear interpolation of the t=0 and t=1 bounds; bounding_box() covers the whole motion.
+    virtual aabb bounding_box_at(double time) const { return bounding_box(); }
+
+    // Recompute any cached bounds after the geometry underneath has moved.
+    virtual void refit() {}
+
+    // Entry and exit along the whole line of r, in one traversal: widens crossings to cover
+    // every t at which the line crosses the surface, and returns false if it crosses none.
+    // For a closed convex object, crossings is then where the line is inside it. The
+    // default takes the first crossing and the one after it, with two hit() calls.
+    virtual bool hit_interval(const ray &r, interval &crossings) const
+    {
+        hit_record rec1, rec2;
+        if (!hit(r, interval(-infinity, +infinity), rec1))
+            return false;
+        crossings = interval(crossings, interval(rec1.t, rec1.t));
+        if (hit(r, interval(rec1.t + 0.0001, infinity), rec2))
+            crossings = interval(crossings, interval(rec2.t, rec2.t));
+        return true;
+    }
+
+    // Appends every primitive at or below this object that emits light and can be sampled
+    // directly, for explicit light sampling. Containers recurse; transformed primitives are
+    // left out and are only found by paths that happen to hit them.
+    virtual void collect_emitters(std::vector<const hittable *> &emitters) const {}
+
+    // Light sampling of an emitting primitive: a direction from origin towards a point on
+    // it, the density per solid angle of drawing direction that way (0 if it misses the
+    // primitive), and the primitive's emitted power (luminance, up to a constant factor).
+    virtual vec3 random(const point3 &origin, const sample2d &s, double time) const { return vec3(1, 0, 0); }
+    virtual double pdf_value(const point3 &origin, const vec3 &direction, double time) const { return 0; }
+    virtual double emitted_power() const { return 0; }
+
+    unsigned int object_id() const { return id; }
+
+protected:
+    unsigned int id; // 对象编号，供 ID 输出通道使用（从 1 开始）
+
+private:
+    static unsigned int next_id()
+    {
+        static std::atomic<unsigned int> counter{1};
+        return counter++;
+    }
 };
 
 class translate : public hittable
@@ -41,10 +127,24 @@ public:
         bbox = object->bounding_box() + offset;
     }
 
+    void refit() override
+    {
+        object->refit();
+        bbox = object->bounding_box() + offset;
+    }
+
+    aabb bounding_box_at(double time) const override
+    {
+        return object->bounding_box_at(time) + offset;
+    }
+
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
         // Move the ray backwards by the offset
         ray offset_r(r.origin() - offset, r.direction(), r.time());
+        if (r.has_differentials())
+            offset_r.set_differentials(r.rx_origin() - offset, r.rx_direction(),
+                                       r.ry_origin() - offset, r.ry_direction());
 
         // Determine where (if any) an intersection occurs along the offset ray
         if (!object->hit(offset_r, ray_t, rec))
@@ -56,6 +156,16 @@ public:
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t, double &transmittance) const override
+    {
+        return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t, transmittance);
+    }
+
+    bool hit_interval(const ray &r, interval &crossings) const override
+    {
+        return object->hit_interval(ray(r.origin() - offset, r.direction(), r.time()), crossings);
+    }
+
     aabb bounding_box() const override { return bbox; }
 
 private:
@@ -72,51 +182,27 @@ public:
         auto radians = degrees_to_radians(angle);
         sin_theta = sin(radians);
         cos_theta = cos(radians);
-        bbox = object->bounding_box();
-
-        point3 min(infinity, infinity, infinity);
-        point3 max(-infinity, -infinity, -infinity);
-
-        for (int i = 0; i < 2; i++)
-        {
-            for (int j = 0; j < 2; j++)
-            {
-                for (int k = 0; k < 2; k++)
-                {
-                    auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-                    auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-                    auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
-
-                    auto newx = cos_theta * x + sin_theta * z;
-                    auto newz = -sin_theta * x + cos_theta * z;
-
-                    vec3 tester(newx, y, newz);
+        set_bounding_box();
+    }
 
-                    for (int c = 0; c < 3; c++)
-                    {
-                        min[c] = fmin(min[c], tester[c]);
-                        max[c] = fmax(max[c], tester[c]);
-                    }
-                }
-            }
-        }
+    void refit() override
+    {
+        object->refit();
+        set_bounding_box();
+    }
 
-        bbox = aabb(min, max);
+    aabb bounding_box_at(double time) const override
+    {
+        return rotated_box(object->bounding_box_at(time));
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
         // Change the ray from world space to object space
-        auto origin = r.origin();
-        auto direction = r.direction();
-
-        origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-        origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-        direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-        direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-        ray rotated_r(origin, direction, r.time());
+        ray rotated_r(to_object(r.origin()), to_object(r.direction()), r.time());
+        if (r.has_differentials())
+            rotated_r.set_differentials(to_object(r.rx_origin()), to_object(r.rx_direction()),
+                                        to_object(r.ry_origin()), to_object(r.ry_direction()));
 
         // Determine where (if any) an intersection occurs in object space
         if (!object->hit(rotated_r, ray_t, rec))
@@ -138,6 +224,17 @@ public:
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t, double &transmittance) const override
+    {
+        return object->occluded(ray(to_object(r.origin()), to_object(r.direction()), r.time()), ray_t,
+                                transmittance);
+    }
+
+    bool hit_interval(const ray &r, interval &crossings) const override
+    {
+        return object->hit_interval(ray(to_object(r.origin()), to_object(r.direction()), r.time()), crossings);
+    }
+
     aabb bounding_box() const override { return bbox; }
 
 private:
@@ -145,4 +242,50 @@ private:
     double sin_theta;
     double cos_theta;
     aabb bbox;
+
+    void set_bounding_box()
+    {
+        bbox = rotated_box(object->bounding_box());
+    }
+
+    vec3 to_object(const vec3 &world) const
+    {
+        auto v = world;
+        v[0] = cos_theta * world[0] - sin_theta * world[2];
+        v[2] = sin_theta * world[0] + cos_theta * world[2];
+        return v;
+    }
+
+    aabb rotated_box(const aabb &box) const
+    {
+        // Bound the rotated object by rotating the eight corners of its own bounding box.
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++)
+        {
+            for (int j = 0; j < 2; j++)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    auto x = i * box.x.max + (1 - i) * box.x.min;
+                    auto y = j * box.y.max + (1 - j) * box.y.min;
+                    auto z = k * box.z.max + (1 - k) * box.z.min;
+
+                    auto newx = cos_theta * x + sin_theta * z;
+                    auto newz = -sin_theta * x + cos_theta * z;
+
+                    vec3 tester(newx, y, newz);
+
+                    for (int c = 0; c < 3; c++)
+                    {
+                        min[c] = fmin(min[c], tester[c]);
+                        max[c] = fmax(max[c], tester[c]);
+                    }
+                }
+            }
+        }
+
+        return aabb(min, max);
+    }
 };
\ No newline at end of file
@@ -43,8 +43,48 @@ public:
 
         return hit_anything;
     }
+    bool occluded(const ray &r, interval ray_t, double &transmittance) const override
+    {
+        for (const auto &object : objects)
+            if (object->occluded(r, ray_t, transmittance))
+                return true;
+        return false;
+    }
+
+    bool hit_interval(const ray &r, interval &crossings) const override
+    {
+        bool crossed = false;
+        for (const auto &object : objects)
+            crossed |= object->hit_interval(r, crossings);
+        return crossed;
+    }
+
     aabb bounding_box() const override { return box; }
 
+    void collect_emitters(std::vector<const hittable *> &emitters) const override
+    {
+        for (const auto &object : objects)
+            object->collect_emitters(emitters);
+    }
+
+    aabb bounding_box_at(double time) const override
+    {
+        aabb time_box;
+        for (const auto &object : objects)
+            time_box = aabb(time_box, object->bounding_box_at(time));
+        return time_box;
+    }
+
+    void refit() override
+    {
+        box = aabb();
+        for (const auto &object : objects)
+        {
+            object->refit();
+            box = aabb(box, object->bounding_box());
+        }
+    }
+
 private:
     aabb box;
 };
@@ -38,7 +38,8 @@ public:
         return interval(min - padding, max + padding);
     }
 
-    interval(const interval &a, const interval &b) : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
+    interval(const interval &a, const interval &b)
+        : min(a.min <= b.min ? a.min : b.min), max(a.max >= b.max ? a.max : b.max) {}
 
     static const interval empty, universe;
 };
@@ -0,0 +1,345 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "hittable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Choosing which emitting primitive to sample for direct lighting. Every selector picks one
+// light for a shading point from a single uniform number and can report the probability it
+// would have picked a given light there, which multiple importance sampling needs.
+
+enum class light_selection
+{
+    uniform, // Every light equally likely
+    power,   // In proportion to emitted power, from an alias table
+    bvh      // Power over distance squared, by descending a tree over the lights
+};
+
+class light_selector
+{
+public:
+    explicit light_selector(std::vector<const hittable *> emitters)
+    {
+        // Lights that emit nothing would only waste samples.
+        for (auto light : emitters)
+            if (light->emitted_power() > 0)
+                lights.push_back(light);
+        for (size_t i = 0; i < lights.size(); i++)
+            index_of[lights[i]->object_id()] = i;
+    }
+
+    virtual ~light_selector() = default;
+
+    // Picks a light for shading point p. pmf receives the probability of the choice; returns
+    // nullptr if there is nothing to pick.
+    virtual const hittable *sample(const point3 &p, double u, double &pmf) const = 0;
+
+    // Probability that sample() picks light at shading point p.
+    virtual double pmf(const point3 &p, const hittable *light) const = 0;
+
+    bool empty() const { return lights.empty(); }
+    size_t size() const { return lights.size(); }
+
+    // The sampled light a hit primitive belongs to, or nullptr if it is not one.
+    const hittable *light(unsigned int primitive_id) const
+    {
+        auto it = index_of.find(primitive_id);
+        return (it == index_of.end()) ? nullptr : lights[it->second];
+    }
+
+protected:
+    std::vector<const hittable *> lights;
+    std::unordered_map<unsigned int, size_t> index_of; // Primitive ID -> index into lights
+
+    size_t index(const hittable *light) const
+    {
+        auto it = index_of.find(light->object_id());
+        return (it == index_of.end()) ? lights.size() : it->second;
+    }
+};
+
+class uniform_light_selector : public light_selector
+{
+public:
+    using light_selector::light_selector;
+
+    const hittable *sample(const point3 &, double u, double &pmf) const override
+    {
+        if (lights.empty())
+            return nullptr;
+        pmf = 1.0 / lights.size();
+        return lights[std::min(static_cast<size_t>(u * lights.size()), lights.size() - 1)];
+    }
+
+    double pmf(const point3 &, const hittable *light) const override
+    {
+        return (index(light) < lights.size()) ? 1.0 / lights.size() : 0;
+    }
+};
+
+class power_light_selector : public light_selector
+{
+public:
+    // Walker's alias method (in Vose's construction): one table lookup and one comparison
+    // per choice, however many lights there are.
+    explicit power_light_selector(std::vector<const hittable *> emitters) : light_selector(std::move(emitters))
+    {
+        auto n = lights.size();
+        double total = 0;
+        for (auto light : lights)
+            total += light->emitted_power();
+
+        probability.resize(n);
+        bins.resize(n);
+        std::vector<double> scaled(n);
+        std::vector<size_t> small, large;
+        for (size_t i = 0; i < n; i++)
+        {
+            probability[i] = lights[i]->emitted_power() / total;
+            scaled[i] = probability[i] * n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty())
+        {
+            auto s = small.back();
+            small.pop_back();
+            auto l = large.back();
+            large.pop_back();
+
+            bins[s] = {scaled[s], l};
+            scaled[l] -= 1 - scaled[s];
+            (scaled[l] < 1 ? small : large).push_back(l);
+        }
+
+        // Whatever is left is 1 up to rounding.
+        for (auto i : small)
+            bins[i] = {1, i};
+        for (auto i : large)
+            bins[i] = {1, i};
+    }
+
+    const hittable *sample(const point3 &, double u, double &pmf) const override
+    {
+        if (lights.empty())
+            return nullptr;
+
+        // The integer part of u * n picks the bin, the fraction decides between its two lights.
+        auto x = u * bins.size();
+        auto i = std::min(static_cast<size_t>(x), bins.size() - 1);
+        auto chosen = (x - i < bins[i].threshold) ? i : bins[i].alias;
+        pmf = probability[chosen];
+        return lights[chosen];
+    }
+
+    double pmf(const point3 &, const hittable *light) const override
+    {
+        auto i = index(light);
+        return (i < lights.size()) ? probability[i] : 0;
+    }
+
+private:
+    struct bin
+    {
+        double threshold; // Chance of keeping the bin's own light
+        size_t alias;     // The light taken otherwise
+    };
+
+    std::vector<double> probability;
+    std::vector<bin> bins;
+};
+
+class bvh_light_selector : public light_selector
+{
+public:
+    // A binary tree over the lights, each node holding the bounds and total power beneath it.
+    // Choosing descends from the root, going left or right in proportion to each child's
+    // importance at the shading point: its power over the squared distance to its bounds, so
+    // nearby lights are found even when thousands of distant ones outshine them together.
+    explicit bvh_light_selector(std::vector<const hittable *> emitters) : light_selector(std::move(emitters))
+    {
+        if (lights.empty())
+            return;
+
+        std::vector<size_t> order(lights.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        paths.resize(lights.size());
+        nodes.reserve(2 * lights.size());
+        build(order, 0, order.size(), 0, 0);
+    }
+
+    const hittable *sample(const point3 &p, double u, double &pmf) const override
+    {
+        if (nodes.empty())
+            return nullptr;
+
+        pmf = 1;
+        size_t n = 0;
+        while (!nodes[n].is_leaf())
+        {
+            auto left = importance(p, nodes[n + 1]);
+            auto right = importance(p, nodes[nodes[n].second_child]);
+            if (left + right <= 0)
+                return nullptr;
+
+            // Reuse u: the part of it below the left share picks left, and it is stretched back
+            // to [0,1) for the next level.
+            auto p_left = left / (left + right);
+            if (u < p_left)
+            {
+                u = std::fmin(u / p_left, 1 - 1e-12);
+                pmf *= p_left;
+                n = n + 1;
+            }
+            else
+            {
+                u = std::fmin((u - p_left) / (1 - p_left), 1 - 1e-12);
+                pmf *= 1 - p_left;
+                n = nodes[n].second_child;
+            }
+        }
+        return lights[nodes[n].light];
+    }
+
+    double pmf(const point3 &p, const hittable *light) const override
+    {
+        // Retraces the light's branch choices (one bit per level, root first) with the
+        // probabilities sample() would have used.
+        auto i = index(light);
+        if (i >= lights.size())
+            return 0;
+
+        double pmf = 1;
+        size_t n = 0;
+        auto path = paths[i];
+        while (!nodes[n].is_leaf())
+        {
+            auto left = importance(p, nodes[n + 1]);
+            auto right = importance(p, nodes[nodes[n].second_child]);
+            if (left + right <= 0)
+                return 0;
+
+            if (path & 1)
+            {
+                pmf *= right / (left + right);
+                n = nodes[n].second_child;
+            }
+            else
+            {
+                pmf *= left / (left + right);
+                n = n + 1;
+            }
+            path >>= 1;
+        }
+        return pmf;
+    }
+
+private:
+    struct node
+    {
+        aabb bounds;
+        double power;
+        double center[3];            // Centre of the bounds, for importance()
+        double min_distance_squared; // Half the diagonal of the bounds, squared
+        size_t second_child;         // Interior nodes: index of the right child (the left one follows)
+        size_t light;                // Leaves: index into lights
+
+        bool is_leaf() const { return second_child == 0; }
+    };
+
+    std::vector<node> nodes;          // Depth first, left child right after its parent
+    std::vector<std::uint64_t> paths; // Per light: branch bits from the root, 1 = right
+
+    size_t build(std::vector<size_t> &order, size_t start, size_t end, std::uint64_t path, int depth)
+    {
+        auto n = nodes.size();
+        nodes.push_back(node{aabb(), 0, {0, 0, 0}, 0, 0, 0});
+
+        if (end - start == 1)
+        {
+            auto i = order[start];
+            nodes[n].bounds = lights[i]->bounding_box();
+            nodes[n].power = lights[i]->emitted_power();
+            nodes[n].light = i;
+            paths[i] = path;
+            set_distance_bounds(nodes[n]);
+            return n;
+        }
+
+        // Split at the median centroid along the longest axis. Median splits keep the depth at
+        // log2 of the light count, well inside the 64 bits of a path.
+        aabb centroids;
+        for (auto k = start; k < end; k++)
+        {
+            auto box = lights[order[k]]->bounding_box();
+            auto c = 0.5 * (point3(box.x.min, box.y.min, box.z.min) + point3(box.x.max, box.y.max, box.z.max));
+            centroids = aabb(centroids, aabb(c, c));
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (centroids.axis(a).size() > centroids.axis(axis).size())
+                axis = a;
+        auto mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&](size_t a, size_t b)
+                         {
+                             auto span_a = lights[a]->bounding_box().axis(axis);
+                             auto span_b = lights[b]->bounding_box().axis(axis);
+                             return span_a.min + span_a.max < span_b.min + span_b.max;
+                         });
+
+        build(order, start, mid, path, depth + 1);
+        auto right = build(order, mid, end, path | (std::uint64_t(1) << depth), depth + 1);
+
+        nodes[n].second_child = right;
+        nodes[n].bounds = aabb(nodes[n + 1].bounds, nodes[right].bounds);
+        nodes[n].power = nodes[n + 1].power + nodes[right].power;
+        set_distance_bounds(nodes[n]);
+        return n;
+    }
+
+    static void set_distance_bounds(node &n)
+    {
+        double half_diagonal_squared = 0;
+        for (int a = 0; a < 3; a++)
+        {
+            auto span = n.bounds.axis(a);
+            n.center[a] = 0.5 * (span.min + span.max);
+            half_diagonal_squared += 0.25 * span.size() * span.size();
+        }
+        n.min_distance_squared = half_diagonal_squared;
+    }
+
+    static double importance(const point3 &p, const node &n)
+    {
+        // Power over the squared distance from p to the centre of the bounds, never closer
+        // than half their diagonal, so points inside or near a cluster do not single out
+        // whichever child happens to be nearest.
+        auto dx = n.center[0] - p.x;
+        auto dy = n.center[1] - p.y;
+        auto dz = n.center[2] - p.z;
+        return n.power / std::fmax(dx * dx + dy * dy + dz * dz, n.min_distance_squared);
+    }
+};
+
+inline std::unique_ptr<light_selector> make_light_selector(light_selection type,
+                                                          std::vector<const hittable *> emitters)
+{
+    switch (type)
+    {
+    case light_selection::uniform:
+        return std::make_unique<uniform_light_selector>(std::move(emitters));
+    case light_selection::power:
+        return std::make_unique<power_light_selector>(std::move(emitters));
+    default:
+        return std::make_unique<bvh_light_selector>(std::move(emitters));
+    }
+}
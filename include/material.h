@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rtweekend.h"
+#include "sampler.h"
 #include "texture.h"
 
 class hit_record;
@@ -8,14 +9,46 @@ class hit_record;
 class material
 {
 public:
+    material() : id(next_id()) {}
     virtual ~material() = default;
 
-    virtual bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const = 0;
+    // Samples a scattered ray. pdf receives the solid-angle density the direction was drawn
+    // with, or 0 for a specular direction, whose attenuation already is the full weight of
+    // the path; otherwise the path weight is attenuation * scattering_pdf() / pdf.
+    virtual bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered,
+                         double &pdf) const = 0;
+
+    // Density per solid angle of scattering from r_in into scattered: the cosine-weighted
+    // BSDF divided by the attenuation. Zero for specular materials.
+    virtual double scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const
+    {
+        return 0;
+    }
 
     virtual color emitted(double u, double v, const point3 &p) const
     {
         return color(0, 0, 0);
     }
+
+    // True for materials whose emission the camera may sample directly.
+    virtual bool is_emitter() const { return false; }
+
+    // Surface color as seen by the denoiser's feature buffer.
+    virtual color base_color(const hit_record &rec) const
+    {
+        return color(1, 1, 1);
+    }
+
+    unsigned int material_id() const { return id; }
+
+private:
+    unsigned int id; // 材质编号，供 ID 输出通道使用（从 1 开始）
+
+    static unsigned int next_id()
+    {
+        static std::atomic<unsigned int> counter{1};
+        return counter++;
+    }
 };
 
 class lambertian : public material
@@ -23,17 +56,26 @@ class lambertian : public material
 public:
     lambertian(const color &a) : albedo(make_shared<solid_color>(a)) {}
     lambertian(shared_ptr<texture> a) : albedo(a) {}
-    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
+    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered,
+                 double &pdf) const override
     {
-        auto scatter_direction = rec.normal + random_unit_vector();
+        // Cosine-weighted about the normal, which is exactly the Lambertian lobe.
+        onb basis(rec.normal);
+        auto direction = basis.local(cosine_hemisphere(sample_2d()));
+        scattered = ray(rec.p, direction, r_in.time());
+        attenuation = albedo->value(rec.u, rec.v, rec.p, rec.du, rec.dv);
+        pdf = cosine_hemisphere_pdf(dot(rec.normal, direction));
+        return true;
+    }
 
-        // 捕捉退化散射方向
-        if (scatter_direction.near_zero())
-            scatter_direction = rec.normal;
+    double scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const override
+    {
+        return cosine_hemisphere_pdf(dot(rec.normal, scattered.direction()) / scattered.direction().length());
+    }
 
-        scattered = ray(rec.p, scatter_direction, r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
-        return true;
+    color base_color(const hit_record &rec) const override
+    {
+        return albedo->value(rec.u, rec.v, rec.p, rec.du, rec.dv);
     }
 
 private:
@@ -45,14 +87,22 @@ class metal : public material
 public:
     metal(const color &a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
+    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered,
+                 double &pdf) const override
     {
+        // The fuzzed lobe has no closed-form density, so it is treated as specular.
+        pdf = 0;
         vec3 reflected = reflect(r_in.direction().normalize(), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz * random_unit_vector(), r_in.time());
+        scattered = ray(rec.p, reflected + fuzz * sample_unit_vector(), r_in.time());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
+    color base_color(const hit_record &rec) const override
+    {
+        return albedo;
+    }
+
 private:
     color albedo;
     double fuzz;
@@ -63,9 +113,10 @@ class dielectric : public material
 public:
     dielectric(double index_of_refraction) : ir(index_of_refraction) {}
 
-    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
-        const override
+    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered,
+                 double &pdf) const override
     {
+        pdf = 0;
         attenuation = color(1.0, 1.0, 1.0);
         double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
@@ -76,7 +127,7 @@ public:
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sample_1d())
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -103,8 +154,8 @@ public:
     diffuse_light(shared_ptr<texture> a) : emit(a) {}
     diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
 
-    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
-        const override
+    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered,
+                 double &pdf) const override
     {
         return false;
     }
@@ -114,6 +165,8 @@ public:
         return emit->value(u, v, p);
     }
 
+    bool is_emitter() const override { return true; }
+
 private:
     shared_ptr<texture> emit;
 };
@@ -124,14 +177,25 @@ public:
     isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
     isotropic(shared_ptr<texture> a) : albedo(a) {}
 
-    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
-        const override
+    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered,
+                 double &pdf) const override
     {
-        scattered = ray(rec.p, random_unit_vector(), r_in.time());
+        scattered = ray(rec.p, sample_unit_vector(), r_in.time());
         attenuation = albedo->value(rec.u, rec.v, rec.p);
+        pdf = uniform_sphere_pdf();
         return true;
     }
 
+    double scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const override
+    {
+        return uniform_sphere_pdf();
+    }
+
+    color base_color(const hit_record &rec) const override
+    {
+        return albedo->value(rec.u, rec.v, rec.p);
+    }
+
 private:
     shared_ptr<texture> albedo;
 };
\ No newline at end of file
@@ -3,6 +3,14 @@
 #include <cmath>
 #include "vec.h"
 #include "rtweekend.h"
+#include "sampling.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTW_VEC_SSE 1
+#include <emmintrin.h>
+#endif
 
 // vec2 implementation starts here
 vec2::vec2()
@@ -303,27 +311,133 @@ vec3 vec3::random(double min, double max)
 
 vec3 random_in_unit_sphere()
 {
-    while (true)
-    {
-        auto p = vec3::random(-1, 1);
-        if (p.length_squared() < 1)
-            return p;
-    }
+    // A uniform direction scaled by the cube root of a uniform number, whose distribution
+    // r^3 matches the volume of the ball inside radius r.
+    return static_cast<float>(std::cbrt(random_double())) * uniform_sphere({random_double(), random_double()});
 }
 
 vec3 random_in_unit_disk()
 {
-    while (true)
+    return concentric_disk({random_double(), random_double()});
+}
+
+vec3 random_unit_vector()
+{
+    return uniform_sphere({random_double(), random_double()});
+}
+
+namespace
+{
+    const size_t batch_width = 4;
+
+    inline float random_float()
     {
-        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (p.length_squared() < 1)
-            return p;
+        // Uniform in [0,1) from a single 32-bit draw (random_double() needs two).
+        return (random_generator()() >> 8) * 0x1p-24f;
+    }
+
+    void unit_circle(const float *t, float *cos_out, float *sin_out)
+    {
+        // cos and sin of the angle pi * (2t - 1), which is uniform when t is, for four t.
+        // Both come from polynomials of the half angle y in [-pi/2, pi/2): sin 2y = 2 sin y
+        // cos y and cos 2y = 1 - 2 sin^2 y, accurate to about 1e-7.
+#ifdef RTW_VEC_SSE
+        auto y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(t), _mm_set1_ps(0.5f)), _mm_set1_ps(3.14159265f));
+        auto y2 = _mm_mul_ps(y, y);
+        auto s = _mm_set1_ps(-1.0f / 39916800);
+        s = _mm_add_ps(_mm_mul_ps(s, y2), _mm_set1_ps(1.0f / 362880));
+        s = _mm_add_ps(_mm_mul_ps(s, y2), _mm_set1_ps(-1.0f / 5040));
+        s = _mm_add_ps(_mm_mul_ps(s, y2), _mm_set1_ps(1.0f / 120));
+        s = _mm_add_ps(_mm_mul_ps(s, y2), _mm_set1_ps(-1.0f / 6));
+        s = _mm_add_ps(_mm_mul_ps(s, y2), _mm_set1_ps(1.0f));
+        s = _mm_mul_ps(s, y);
+        auto c = _mm_set1_ps(1.0f / 479001600);
+        c = _mm_add_ps(_mm_mul_ps(c, y2), _mm_set1_ps(-1.0f / 3628800));
+        c = _mm_add_ps(_mm_mul_ps(c, y2), _mm_set1_ps(1.0f / 40320));
+        c = _mm_add_ps(_mm_mul_ps(c, y2), _mm_set1_ps(-1.0f / 720));
+        c = _mm_add_ps(_mm_mul_ps(c, y2), _mm_set1_ps(1.0f / 24));
+        c = _mm_add_ps(_mm_mul_ps(c, y2), _mm_set1_ps(-0.5f));
+        c = _mm_add_ps(_mm_mul_ps(c, y2), _mm_set1_ps(1.0f));
+        auto two_s = _mm_add_ps(s, s);
+        _mm_storeu_ps(sin_out, _mm_mul_ps(two_s, c));
+        _mm_storeu_ps(cos_out, _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(two_s, s)));
+#else
+        for (size_t k = 0; k < batch_width; k++)
+        {
+            auto angle = 3.14159265f * (2 * t[k] - 1);
+            cos_out[k] = std::cos(angle);
+            sin_out[k] = std::sin(angle);
+        }
+#endif
+    }
+
+    void sqrt_4(float *v)
+    {
+#ifdef RTW_VEC_SSE
+        _mm_storeu_ps(v, _mm_sqrt_ps(_mm_max_ps(_mm_loadu_ps(v), _mm_setzero_ps())));
+#else
+        for (size_t k = 0; k < batch_width; k++)
+            v[k] = std::sqrt(std::fmax(v[k], 0.0f));
+#endif
+    }
+
+    template <typename Draw, typename Emit>
+    void fill_batch(vec3 *out, size_t count, Draw draw, Emit emit)
+    {
+        // draw(z, r2) picks a lane's height and squared radius; the square roots and the
+        // circle are then evaluated four lanes at a time, and emit(z, r, cos, sin) builds
+        // each point.
+        float z[batch_width], r[batch_width], t[batch_width], c[batch_width], s[batch_width];
+        for (size_t i = 0; i < count; i += batch_width)
+        {
+            for (size_t k = 0; k < batch_width; k++)
+            {
+                draw(z[k], r[k]);
+                t[k] = random_float();
+            }
+            unit_circle(t, c, s);
+            sqrt_4(r);
+            auto lanes = std::min(batch_width, count - i);
+            for (size_t k = 0; k < lanes; k++)
+                out[i + k] = emit(z[k], r[k], c[k], s[k]);
+        }
+    }
+
+    void draw_sphere(float &z, float &r2)
+    {
+        z = 1 - 2 * random_float();
+        r2 = 1 - z * z;
     }
 }
 
-vec3 random_unit_vector()
+void random_unit_vector(vec3 *out, size_t count)
+{
+    fill_batch(out, count, draw_sphere, [](float z, float r, float c, float s) { return vec3(r * c, r * s, z); });
+}
+
+void random_in_unit_sphere(vec3 *out, size_t count)
+{
+    // The radius is the largest of three uniform numbers, which has the same r^3
+    // distribution as a cube root and needs no transcendental function.
+    fill_batch(out, count, draw_sphere,
+               [](float z, float r, float c, float s)
+               {
+                   auto radius = std::max(random_float(), std::max(random_float(), random_float()));
+                   return radius * vec3(r * c, r * s, z);
+               });
+}
+
+void random_in_unit_disk(vec3 *out, size_t count)
 {
-    return random_in_unit_sphere().normalize();
+    // Polar mapping: the radius is the square root of a uniform number.
+    fill_batch(
+        out, count,
+        [](float &z, float &r2)
+        {
+            z = 0;
+            r2 = random_float();
+        },
+        [](float, float r, float c, float s) { return vec3(r * c, r * s, 0); });
 }
 
 vec3 random_on_hemisphere(const vec3 &normal)
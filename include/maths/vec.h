@@ -2,6 +2,7 @@
 #include <iostream>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 
 class vec2
 {
@@ -71,6 +72,10 @@ vec3 cross(const vec3 &u, const vec3 &v);
 vec3 random_in_unit_sphere();
 vec3 random_in_unit_disk();
 vec3 random_unit_vector();
+// Batch forms: fill out[0..count) with independent samples, four at a time with SIMD.
+void random_in_unit_sphere(vec3 *out, size_t count);
+void random_in_unit_disk(vec3 *out, size_t count);
+void random_unit_vector(vec3 *out, size_t count);
 vec3 random_on_hemisphere(const vec3 &normal);
 vec3 reflect(const vec3 &v, const vec3 &n);
 vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat);
@@ -0,0 +1,635 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "rtw_std_image.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class mipmap;
+
+// How a mipmap stores its linear texels: 8-bit images are decoded to half floats (plenty for
+// 8 bits of sRGB precision at half the memory), HDR images keep full 32-bit floats so very
+// bright values such as the sun in an environment map survive.
+enum class texel_format
+{
+    half_float,
+    full_float
+};
+
+class texture_tile_pool
+{
+public:
+    // Every MIP-mapped texture keeps its texels in tiles drawn from this one pool. With a
+    // budget set (set_budget(), or the RTW_TEXTURE_BUDGET_MB environment variable), loading a
+    // tile beyond the budget first evicts tiles that have not been sampled recently.
+    static texture_tile_pool &global()
+    {
+        static texture_tile_pool pool;
+        return pool;
+    }
+
+    void set_budget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        if (budget > 0 && resident > budget)
+            evict(resident - budget);
+    }
+
+    size_t budget_bytes() const { return budget; }
+    size_t resident_bytes() const { return resident; }
+
+    // Renders read tiles without locking, so a tile evicted while any render is running is
+    // only freed once the last running render has finished.
+    void begin_render()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active_renders++;
+    }
+
+    void end_render()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--active_renders == 0)
+            free_retired();
+    }
+
+private:
+    friend class mipmap;
+
+    std::mutex mutex;
+    // Written under mutex, but also read by render threads that do not take it.
+    std::atomic<size_t> budget{0};   // 0 means unlimited
+    std::atomic<size_t> resident{0}; // Bytes in tiles currently installed in a texture
+    int active_renders = 0;
+    std::vector<mipmap *> textures;
+    std::vector<unsigned char *> retired;
+    size_t clock_texture = 0; // CLOCK hand: texture index ...
+    size_t clock_slot = 0;    // ... and tile slot within it
+
+    texture_tile_pool()
+    {
+        if (auto megabytes = getenv("RTW_TEXTURE_BUDGET_MB"))
+            budget = static_cast<size_t>(atof(megabytes) * 1024 * 1024);
+    }
+
+    ~texture_tile_pool() { free_retired(); }
+
+    void add(mipmap *texture)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        textures.push_back(texture);
+    }
+
+    void remove(mipmap *texture);
+    bool reserve(size_t bytes, bool may_evict);
+    void release(unsigned char *texels, size_t bytes);
+    void evict(size_t bytes);
+
+    void free_retired()
+    {
+        for (auto texels : retired)
+            delete[] texels;
+        retired.clear();
+    }
+};
+
+// Holds texture_tile_pool::begin_render() for its lifetime, so tiles sampled by the render's
+// threads are not freed under them.
+class texture_render_scope
+{
+public:
+    texture_render_scope() { texture_tile_pool::global().begin_render(); }
+    ~texture_render_scope() { texture_tile_pool::global().end_render(); }
+    texture_render_scope(const texture_render_scope &) = delete;
+    texture_render_scope &operator=(const texture_render_scope &) = delete;
+};
+
+class mipmap
+{
+public:
+    mipmap(const std::string &filename) : source(filename)
+    {
+        // Decode the image to linear color, build the whole pyramid once, and tile it. Coarse
+        // levels are installed first, so under a tight budget it is the finest tiles that
+        // wait to be loaded on demand.
+        scoped_phase timer(render_phase::texture_load);
+        bool hdr = false;
+        auto pyramid = decode(&hdr);
+        if (pyramid.empty())
+            return;
+
+        format = hdr ? texel_format::full_float : texel_format::half_float;
+        tile_bytes = tile_texels * 3 * (hdr ? sizeof(float) : sizeof(std::uint16_t));
+
+        size_t slot_count = 0;
+        for (const auto &scan : pyramid)
+        {
+            level lvl;
+            lvl.width = scan.width;
+            lvl.height = scan.height;
+            lvl.tiles_x = (scan.width + tile_size - 1) / tile_size;
+            lvl.tiles_y = (scan.height + tile_size - 1) / tile_size;
+            lvl.first_slot = slot_count;
+            slot_count += lvl.tiles_x * lvl.tiles_y;
+            levels.push_back(lvl);
+        }
+
+        // Levels that fit in a single tile cost almost nothing and are never evicted, so a
+        // texture always keeps a cheap coarse version resident.
+        pinned_slots = slot_count;
+        for (const auto &lvl : levels)
+            if (lvl.tiles_x * lvl.tiles_y == 1)
+            {
+                pinned_slots = lvl.first_slot;
+                break;
+            }
+
+        slots.reset(new tile_slot[slot_count]);
+        total_slots = slot_count;
+        texture_tile_pool::global().add(this);
+
+        for (auto lvl = level_count() - 1; lvl >= 0; lvl--)
+            for (auto slot = levels[lvl].first_slot; slot < levels[lvl].first_slot + levels[lvl].tiles_x * levels[lvl].tiles_y; slot++)
+                if (!install_tile(pyramid, lvl, slot, false))
+                    return;
+    }
+
+    ~mipmap()
+    {
+        if (!slots)
+            return;
+        texture_tile_pool::global().remove(this);
+        for (size_t i = 0; i < total_slots; i++)
+            if (auto texels = slots[i].texels.exchange(nullptr))
+                texture_tile_pool::global().release(texels, tile_bytes);
+    }
+
+    mipmap(const mipmap &) = delete;
+    mipmap &operator=(const mipmap &) = delete;
+
+    int width() const { return levels.empty() ? 0 : levels[0].width; }
+    int height() const { return levels.empty() ? 0 : levels[0].height; }
+    int level_count() const { return static_cast<int>(levels.size()); }
+    texel_format storage_format() const { return format; }
+
+    color lookup(double u, double v, double du, double dv) const
+    {
+        // Trilinear filtering: pick the two levels whose texel size brackets the footprint
+        // (du x dv, in [0,1] texture units) and blend bilinear samples from both.
+        auto texels = fmax(du * width(), dv * height());
+        auto lod = (texels > 1) ? std::log2(texels) : 0.0;
+        auto max_lod = static_cast<double>(level_count() - 1);
+        if (lod >= max_lod)
+            return bilinear(level_count() - 1, u, v);
+
+        auto lod0 = static_cast<int>(lod);
+        auto frac = lod - lod0;
+        auto c0 = bilinear(lod0, u, v);
+        if (frac <= 0)
+            return c0;
+        return (1 - frac) * c0 + frac * bilinear(lod0 + 1, u, v);
+    }
+
+private:
+    friend class texture_tile_pool;
+
+    // Texels live in 16x16 tiles, Morton-ordered within each tile, so a bilinear footprint
+    // touches a few neighbouring bytes instead of two scanlines a whole image row apart.
+    static constexpr int tile_log2 = 4;
+    static constexpr int tile_size = 1 << tile_log2;
+    static constexpr int tile_texels = tile_size * tile_size;
+    static constexpr size_t reload_batch = 64; // Tiles restored per decode of an evicted texture
+
+    struct scan_level
+    {
+        int width = 0, height = 0;
+        std::vector<float> data; // Linear RGB, scanline order
+    };
+
+    struct level
+    {
+        int width = 0, height = 0;
+        int tiles_x = 0, tiles_y = 0;
+        size_t first_slot = 0;
+    };
+
+    struct tile_slot
+    {
+        std::atomic<unsigned char *> texels{nullptr}; // Null while the tile is not resident
+        std::atomic<bool> referenced{false};          // Set on sampling, cleared by the CLOCK hand
+    };
+
+    std::string source;
+    texel_format format = texel_format::half_float;
+    size_t tile_bytes = 0;
+    std::vector<level> levels;
+    std::unique_ptr<tile_slot[]> slots;
+    size_t total_slots = 0;
+    size_t pinned_slots = 0; // Slots from here on hold single-tile levels, which stay resident
+    mutable std::mutex load_mutex;
+    const float *decode_half = half_table();
+
+    std::vector<scan_level> decode(bool *is_hdr = nullptr) const
+    {
+        // Level 0 is the image itself in linear color; every further level box-filters the one
+        // above it down to half size (rounding up) until a single texel remains. Filtering in
+        // linear space keeps distant textures from darkening the way averaged sRGB bytes do.
+        std::vector<scan_level> pyramid;
+        rtw_image image(source.c_str());
+        if (image.width() <= 0 || image.height() <= 0)
+            return pyramid;
+        if (is_hdr)
+            *is_hdr = image.is_hdr();
+
+        const auto &to_linear = srgb_to_linear();
+
+        scan_level base;
+        base.width = image.width();
+        base.height = image.height();
+        base.data.resize(base.width * base.height * 3);
+        for (int y = 0; y < base.height; y++)
+            for (int x = 0; x < base.width; x++)
+            {
+                auto texel = &base.data[(y * base.width + x) * 3];
+                if (image.is_hdr())
+                {
+                    auto pixel = image.hdr_pixel_data(x, y);
+                    for (int c = 0; c < 3; c++)
+                        texel[c] = pixel[c];
+                }
+                else
+                {
+                    auto pixel = image.pixel_data(x, y);
+                    for (int c = 0; c < 3; c++)
+                        texel[c] = to_linear[pixel[c]];
+                }
+            }
+        pyramid.push_back(std::move(base));
+
+        while (pyramid.back().width > 1 || pyramid.back().height > 1)
+            pyramid.push_back(downsample(pyramid.back()));
+
+        return pyramid;
+    }
+
+    static scan_level downsample(const scan_level &src)
+    {
+        scan_level dst;
+        dst.width = std::max(1, (src.width + 1) / 2);
+        dst.height = std::max(1, (src.height + 1) / 2);
+        dst.data.resize(dst.width * dst.height * 3);
+
+        for (int y = 0; y < dst.height; y++)
+            for (int x = 0; x < dst.width; x++)
+            {
+                // Average the (up to) 2x2 source texels; odd edges reuse the last row/column.
+                auto x0 = 2 * x, x1 = std::min(2 * x + 1, src.width - 1);
+                auto y0 = 2 * y, y1 = std::min(2 * y + 1, src.height - 1);
+                for (int c = 0; c < 3; c++)
+                {
+                    auto sum = src.data[(y0 * src.width + x0) * 3 + c] + src.data[(y0 * src.width + x1) * 3 + c] +
+                               src.data[(y1 * src.width + x0) * 3 + c] + src.data[(y1 * src.width + x1) * 3 + c];
+                    dst.data[(y * dst.width + x) * 3 + c] = 0.25f * sum;
+                }
+            }
+
+        return dst;
+    }
+
+    static const std::vector<float> &srgb_to_linear()
+    {
+        // Decoding table for 8-bit sRGB values, built once.
+        static const std::vector<float> table = []
+        {
+            std::vector<float> t(256);
+            for (int i = 0; i < 256; i++)
+            {
+                auto c = i / 255.0;
+                t[i] = static_cast<float>((c <= 0.04045) ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    static std::uint16_t float_to_half(float f)
+    {
+        // IEEE 754 binary16, rounded to nearest even; values past the half range become
+        // infinity. Only used while tiling, so it favours clarity over speed.
+        std::uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        std::uint16_t sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+        bits &= 0x7fffffffu;
+
+        if (bits >= 0x47800000u) // At least 65536, infinity or NaN
+            return sign | ((bits > 0x7f800000u) ? 0x7e00u : 0x7c00u);
+        if (bits < 0x38800000u) // Below the smallest normal half: a multiple of 2^-24
+        {
+            float magnitude;
+            std::memcpy(&magnitude, &bits, sizeof(magnitude));
+            return sign | static_cast<std::uint16_t>(std::lrint(magnitude * 16777216.0f));
+        }
+
+        bits += 0xfffu + ((bits >> 13) & 1u);
+        return sign | static_cast<std::uint16_t>((bits - 0x38000000u) >> 13);
+    }
+
+    static float half_to_float(std::uint16_t h)
+    {
+        std::uint32_t sign = static_cast<std::uint32_t>(h & 0x8000u) << 16;
+        std::uint32_t exponent = (h >> 10) & 0x1fu;
+        std::uint32_t mantissa = h & 0x3ffu;
+
+        std::uint32_t bits;
+        if (exponent == 0) // Zero or subnormal
+        {
+            float magnitude = mantissa * (1.0f / 16777216.0f);
+            std::memcpy(&bits, &magnitude, sizeof(bits));
+            bits |= sign;
+        }
+        else if (exponent == 31) // Infinity or NaN
+            bits = sign | 0x7f800000u | (mantissa << 13);
+        else
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    static const float *half_table()
+    {
+        // Every half value decoded once (256 KB), so a texel fetch is a plain table load.
+        static const std::vector<float> table = []
+        {
+            std::vector<float> t(65536);
+            for (size_t h = 0; h < t.size(); h++)
+                t[h] = half_to_float(static_cast<std::uint16_t>(h));
+            return t;
+        }();
+        return table.data();
+    }
+
+    static int morton(int x, int y)
+    {
+        // Interleave the bits of in-tile coordinates: x in the even bits, y in the odd bits.
+        auto spread = [](int v)
+        {
+            v = (v | (v << 2)) & 0x33;
+            v = (v | (v << 1)) & 0x55;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    const unsigned char *install_tile(const std::vector<scan_level> &pyramid, int lvl, size_t slot, bool may_evict) const
+    {
+        // Copies one tile out of a decoded pyramid into its slot. Returns null, leaving the
+        // slot empty, if the pool cannot make room for it.
+        if (!texture_tile_pool::global().reserve(tile_bytes, may_evict))
+            return nullptr;
+
+        const auto &scan = pyramid[lvl];
+        const auto &info = levels[lvl];
+        auto tile = slot - info.first_slot;
+        auto x0 = static_cast<int>(tile % info.tiles_x) * tile_size;
+        auto y0 = static_cast<int>(tile / info.tiles_x) * tile_size;
+
+        auto texels = new unsigned char[tile_bytes];
+        for (int ty = 0; ty < tile_size; ty++)
+            for (int tx = 0; tx < tile_size; tx++)
+            {
+                // Texels past the image edge repeat the edge, matching clamped addressing.
+                auto x = std::min(x0 + tx, scan.width - 1);
+                auto y = std::min(y0 + ty, scan.height - 1);
+                auto src = &scan.data[(y * scan.width + x) * 3];
+                auto dst = morton(tx, ty) * 3;
+                for (int c = 0; c < 3; c++)
+                {
+                    if (format == texel_format::full_float)
+                        reinterpret_cast<float *>(texels)[dst + c] = src[c];
+                    else
+                        reinterpret_cast<std::uint16_t *>(texels)[dst + c] = float_to_half(src[c]);
+                }
+            }
+
+        slots[slot].texels.store(texels, std::memory_order_release);
+        return texels;
+    }
+
+    const unsigned char *load_tile(int lvl, size_t slot) const
+    {
+        // Slow path for a tile that was evicted: decode the source again and restore this
+        // tile, plus any other missing tiles of this texture that fit without evicting.
+        std::lock_guard<std::mutex> lock(load_mutex);
+        if (auto texels = slots[slot].texels.load(std::memory_order_acquire))
+            return texels;
+
+        auto pyramid = decode();
+        if (pyramid.size() != levels.size())
+            return magenta_tile();
+
+        // Decoding is by far the expensive part, so also bring back the missing tiles nearest
+        // to this one on the same level; they are the likeliest to be sampled next.
+        const auto &info = levels[lvl];
+        auto tile = static_cast<int>(slot - info.first_slot);
+        auto tx = tile % info.tiles_x, ty = tile / info.tiles_x;
+        std::vector<std::pair<int, size_t>> missing;
+        for (int y = 0; y < info.tiles_y; y++)
+            for (int x = 0; x < info.tiles_x; x++)
+            {
+                auto s = info.first_slot + y * info.tiles_x + x;
+                if (!slots[s].texels.load(std::memory_order_acquire))
+                    missing.emplace_back(std::max(std::abs(x - tx), std::abs(y - ty)), s);
+            }
+        // Never restore more than a quarter of the budget at once, or the batch evicts itself.
+        auto batch = std::min(missing.size(), reload_batch);
+        if (auto budget = texture_tile_pool::global().budget_bytes())
+            batch = std::min(batch, std::max<size_t>(1, budget / tile_bytes / 4));
+        std::partial_sort(missing.begin(), missing.begin() + batch, missing.end());
+
+        // The requested tile is installed last, so the rest of the batch cannot evict it
+        // before it is returned.
+        for (size_t i = 1; i < batch; i++)
+        {
+            install_tile(pyramid, lvl, missing[i].second, true);
+            slots[missing[i].second].referenced.store(true, std::memory_order_relaxed);
+        }
+        return install_tile(pyramid, lvl, slot, true);
+    }
+
+    const unsigned char *magenta_tile() const
+    {
+        // Stand-in for a tile whose source file can no longer be read.
+        static const std::vector<float> full = []
+        {
+            std::vector<float> t(tile_texels * 3, 0.0f);
+            for (size_t i = 0; i < t.size(); i += 3)
+                t[i] = t[i + 2] = 1.0f;
+            return t;
+        }();
+        static const std::vector<std::uint16_t> half = []
+        {
+            std::vector<std::uint16_t> t(tile_texels * 3, 0);
+            for (size_t i = 0; i < t.size(); i += 3)
+                t[i] = t[i + 2] = float_to_half(1.0f);
+            return t;
+        }();
+
+        if (format == texel_format::full_float)
+            return reinterpret_cast<const unsigned char *>(full.data());
+        return reinterpret_cast<const unsigned char *>(half.data());
+    }
+
+    const unsigned char *resident_tile(int lvl, size_t slot) const
+    {
+        // Returns the tile's texels, loading it if it was evicted, and marks it as recently used.
+        const unsigned char *texels = slots[slot].texels.load(std::memory_order_acquire);
+        if (!texels)
+            texels = load_tile(lvl, slot);
+        if (!slots[slot].referenced.load(std::memory_order_relaxed))
+            slots[slot].referenced.store(true, std::memory_order_relaxed);
+        return texels;
+    }
+
+    color decode_texel(const unsigned char *texels, int tx, int ty) const
+    {
+        auto index = morton(tx, ty) * 3;
+        if (format == texel_format::full_float)
+        {
+            auto pixel = reinterpret_cast<const float *>(texels) + index;
+            return color(pixel[0], pixel[1], pixel[2]);
+        }
+        auto pixel = reinterpret_cast<const std::uint16_t *>(texels) + index;
+        return color(decode_half[pixel[0]], decode_half[pixel[1]], decode_half[pixel[2]]);
+    }
+
+    color texel(int lvl, int x, int y) const
+    {
+        const auto &info = levels[lvl];
+        x = std::min(std::max(x, 0), info.width - 1);
+        y = std::min(std::max(y, 0), info.height - 1);
+
+        auto slot = info.first_slot + (y >> tile_log2) * info.tiles_x + (x >> tile_log2);
+        return decode_texel(resident_tile(lvl, slot), x & (tile_size - 1), y & (tile_size - 1));
+    }
+
+    color bilinear(int lvl, double u, double v) const
+    {
+        // (u,v) are image coordinates in [0,1]; texel centers sit at half-integer positions.
+        const auto &info = levels[lvl];
+        auto x = u * info.width - 0.5;
+        auto y = v * info.height - 0.5;
+        auto x0 = static_cast<int>(std::floor(x));
+        auto y0 = static_cast<int>(std::floor(y));
+        auto fx = x - x0;
+        auto fy = y - y0;
+
+        // Most footprints fall inside one tile: fetch it once and read the four texels directly.
+        auto tx = x0 & (tile_size - 1), ty = y0 & (tile_size - 1);
+        if (x0 >= 0 && y0 >= 0 && x0 + 1 < info.width && y0 + 1 < info.height && tx + 1 < tile_size &&
+            ty + 1 < tile_size)
+        {
+            auto slot = info.first_slot + (y0 >> tile_log2) * info.tiles_x + (x0 >> tile_log2);
+            auto texels = resident_tile(lvl, slot);
+            return (1 - fx) * (1 - fy) * decode_texel(texels, tx, ty) + fx * (1 - fy) * decode_texel(texels, tx + 1, ty) +
+                   (1 - fx) * fy * decode_texel(texels, tx, ty + 1) + fx * fy * decode_texel(texels, tx + 1, ty + 1);
+        }
+
+        return (1 - fx) * (1 - fy) * texel(lvl, x0, y0) + fx * (1 - fy) * texel(lvl, x0 + 1, y0) +
+               (1 - fx) * fy * texel(lvl, x0, y0 + 1) + fx * fy * texel(lvl, x0 + 1, y0 + 1);
+    }
+};
+
+inline void texture_tile_pool::remove(mipmap *texture)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find(textures.begin(), textures.end(), texture);
+    if (it == textures.end())
+        return;
+
+    auto index = static_cast<size_t>(it - textures.begin());
+    textures.erase(it);
+    if (clock_texture > index)
+        clock_texture--;
+    else if (clock_texture == index)
+        clock_slot = 0;
+}
+
+inline bool texture_tile_pool::reserve(size_t bytes, bool may_evict)
+{
+    // Accounts for a tile about to be installed. Without may_evict, fails instead of making
+    // room; with it, evicts and succeeds even if nothing could be evicted.
+    std::lock_guard<std::mutex> lock(mutex);
+    if (budget > 0 && resident + bytes > budget)
+    {
+        if (!may_evict)
+            return false;
+        evict(resident + bytes - budget);
+    }
+    resident += bytes;
+    return true;
+}
+
+inline void texture_tile_pool::release(unsigned char *texels, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    resident -= bytes;
+    if (active_renders > 0)
+        retired.push_back(texels);
+    else
+        delete[] texels;
+}
+
+inline void texture_tile_pool::evict(size_t bytes)
+{
+    // CLOCK sweep over every texture's tiles (caller holds the mutex): a tile sampled since the
+    // hand last passed gets a second chance, anything else is evicted. Two full turns visit
+    // every tile at least once with its reference bit already cleared.
+    size_t candidates = 0;
+    for (auto texture : textures)
+        candidates += texture->pinned_slots;
+
+    size_t freed = 0;
+    for (size_t visited = 0; visited < 2 * candidates && freed < bytes;)
+    {
+        if (clock_texture >= textures.size())
+            clock_texture = 0;
+        auto texture = textures[clock_texture];
+        if (clock_slot >= texture->pinned_slots)
+        {
+            clock_slot = 0;
+            clock_texture++;
+            continue;
+        }
+
+        visited++;
+        auto &slot = texture->slots[clock_slot++];
+        if (!slot.texels.load(std::memory_order_relaxed))
+            continue;
+        if (slot.referenced.exchange(false, std::memory_order_relaxed))
+            continue;
+
+        if (auto texels = slot.texels.exchange(nullptr))
+        {
+            resident -= texture->tile_bytes;
+            freed += texture->tile_bytes;
+            if (active_renders > 0)
+                retired.push_back(texels);
+            else
+                delete[] texels;
+        }
+    }
+}
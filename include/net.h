@@ -0,0 +1,350 @@
+#pragma once
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+
+// Minimal POSIX stream sockets for the distributed renderer and the render server: a
+// connection that reads lines and binary blocks through its own buffer, so the same object
+// serves blocking readers (workers, clients) and poll() loops (the coordinator), and a
+// listening socket, TCP or Unix domain, to accept them.
+
+class connection
+{
+public:
+    connection() = default;
+    explicit connection(int fd) : fd(fd) {}
+    connection(const connection &) = delete;
+    connection &operator=(const connection &) = delete;
+    connection(connection &&other) noexcept : fd(std::exchange(other.fd, -1)), in(std::move(other.in)) {}
+    connection &operator=(connection &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            fd = std::exchange(other.fd, -1);
+            in = std::move(other.in);
+        }
+        return *this;
+    }
+    ~connection() { close(); }
+
+    bool is_open() const { return fd >= 0; }
+    int handle() const { return fd; }
+
+    void close()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        in.clear();
+    }
+
+    // Ends the stream both ways without releasing the descriptor, which wakes up a thread
+    // blocked reading it.
+    void shutdown()
+    {
+        if (fd >= 0)
+            ::shutdown(fd, SHUT_RDWR);
+    }
+
+    bool send_all(const void *data, size_t size)
+    {
+        // MSG_NOSIGNAL: a peer that has gone away is an error to report, not SIGPIPE.
+        auto bytes = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            auto sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+            bytes += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    bool send_line(const std::string &line)
+    {
+        auto message = line + '\n';
+        return send_all(message.data(), message.size());
+    }
+
+    // Reads whatever the socket has (blocking until something arrives) into the buffer.
+    // False on end of stream or error.
+    bool receive()
+    {
+        char chunk[64 * 1024];
+        while (true)
+        {
+            auto got = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+            in.append(chunk, static_cast<size_t>(got));
+            return true;
+        }
+    }
+
+    // Takes a complete line (without its newline) from the buffer, if one has arrived.
+    bool take_line(std::string &line)
+    {
+        auto end = in.find('\n');
+        if (end == std::string::npos)
+            return false;
+        line.assign(in, 0, end);
+        in.erase(0, end + 1);
+        return true;
+    }
+
+    // Takes size bytes from the buffer, if that many have arrived.
+    bool take_bytes(void *data, size_t size)
+    {
+        if (in.size() < size)
+            return false;
+        std::memcpy(data, in.data(), size);
+        in.erase(0, size);
+        return true;
+    }
+
+    // Blocking forms of the above: wait for the data to arrive.
+    bool read_line(std::string &line)
+    {
+        while (!take_line(line))
+            if (!receive())
+                return false;
+        return true;
+    }
+
+    bool read_bytes(void *data, size_t size)
+    {
+        while (!take_bytes(data, size))
+            if (!receive())
+                return false;
+        return true;
+    }
+
+private:
+    int fd = -1;
+    std::string in; // Received but not yet taken
+};
+
+class listener
+{
+public:
+    // Listens for TCP connections on port (0 picks a free one) on every interface.
+    explicit listener(int port)
+    {
+        fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+        bool ipv6 = fd >= 0;
+        if (!ipv6)
+            fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return;
+
+        int yes = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        int bound;
+        if (ipv6)
+        {
+            int no = 0;
+            ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+            sockaddr_in6 address{};
+            address.sin6_family = AF_INET6;
+            address.sin6_addr = in6addr_any;
+            address.sin6_port = htons(static_cast<uint16_t>(port));
+            bound = ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+        }
+        else
+        {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_ANY);
+            address.sin_port = htons(static_cast<uint16_t>(port));
+            bound = ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+        }
+
+        if (bound < 0 || ::listen(fd, 64) < 0)
+        {
+            std::cerr << "ERROR: Could not listen on port " << port << ": " << std::strerror(errno) << ".\n";
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // Listens on a Unix domain socket at path, replacing a stale socket file there: one that
+    // nothing accepts connections on. Any other file at path is left alone and is an error.
+    explicit listener(const std::string &path) : path(path)
+    {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "ERROR: Socket path '" << path << "' is too long.\n";
+            return;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        struct stat existing;
+        if (::lstat(path.c_str(), &existing) == 0)
+        {
+            if (!S_ISSOCK(existing.st_mode))
+            {
+                std::cerr << "ERROR: '" << path << "' exists and is not a socket.\n";
+                return;
+            }
+            int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            bool live = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+            if (probe >= 0)
+                ::close(probe);
+            if (live)
+            {
+                std::cerr << "ERROR: A server is already listening on '" << path << "'.\n";
+                return;
+            }
+            ::unlink(path.c_str());
+        }
+
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return;
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || ::listen(fd, 64) < 0)
+        {
+            std::cerr << "ERROR: Could not listen on '" << path << "': " << std::strerror(errno) << ".\n";
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    listener(const listener &) = delete;
+    listener &operator=(const listener &) = delete;
+    ~listener() { close(); }
+
+    bool is_open() const { return fd >= 0; }
+    int handle() const { return fd; }
+
+    void close()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            if (!path.empty())
+                ::unlink(path.c_str());
+        }
+        fd = -1;
+    }
+
+    int port() const
+    {
+        sockaddr_storage address{};
+        socklen_t size = sizeof(address);
+        if (::getsockname(fd, reinterpret_cast<sockaddr *>(&address), &size) < 0)
+            return 0;
+        if (address.ss_family == AF_INET6)
+            return ntohs(reinterpret_cast<sockaddr_in6 *>(&address)->sin6_port);
+        return ntohs(reinterpret_cast<sockaddr_in *>(&address)->sin_port);
+    }
+
+    connection accept()
+    {
+        int client;
+        do
+            client = ::accept(fd, nullptr, nullptr);
+        while (client < 0 && errno == EINTR);
+        if (client >= 0 && path.empty())
+            set_no_delay(client);
+        return connection(client);
+    }
+
+    static void set_no_delay(int socket)
+    {
+        // Requests and replies are small messages; do not hold them back to batch them.
+        int yes = 1;
+        ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+
+private:
+    int fd = -1;
+    std::string path; // Unix domain sockets: the socket file, removed on close
+};
+
+inline connection connect_tcp(const std::string &host, int port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    auto service = std::to_string(port);
+    if (auto error = ::getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses))
+    {
+        std::cerr << "ERROR: Could not resolve '" << host << "': " << gai_strerror(error) << ".\n";
+        return connection();
+    }
+
+    int fd = -1;
+    for (auto a = addresses; a && fd < 0; a = a->ai_next)
+    {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) < 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(addresses);
+
+    if (fd < 0)
+        std::cerr << "ERROR: Could not connect to " << host << ':' << port << ".\n";
+    else
+        listener::set_no_delay(fd);
+    return connection(fd);
+}
+
+inline connection connect_unix(const std::string &path)
+{
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "ERROR: Socket path '" << path << "' is too long.\n";
+        return connection();
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+        std::cerr << "ERROR: Could not connect to '" << path << "'.\n";
+    return connection(fd);
+}
+
+// Waits up to timeout_ms (-1: forever) for any of fds to be readable; returns how many are,
+// with their revents set. Interrupted waits count as timeouts.
+inline int wait_readable(pollfd *fds, size_t count, int timeout_ms)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    auto ready = ::poll(fds, static_cast<nfds_t>(count), timeout_ms);
+    return (ready < 0) ? 0 : ready;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+inline unsigned int hardware_threads()
+{
+    // hardware_concurrency() can hit the filesystem, so query it only once.
+    static const unsigned int n = std::max(1u, std::thread::hardware_concurrency());
+    return n;
+}
+
+template <typename Func>
+void parallel_for(size_t begin, size_t end, size_t min_chunk, Func func)
+{
+    // Split [begin,end) into one contiguous chunk per hardware thread (no chunk smaller than
+    // min_chunk) and call func(chunk_begin, chunk_end) for each. The calling thread handles
+    // the last chunk, and the call returns once every chunk is done.
+    if (end <= begin)
+        return;
+
+    size_t count = end - begin;
+    size_t chunks = std::min<size_t>(hardware_threads(), (count + min_chunk - 1) / min_chunk);
+    if (chunks <= 1)
+    {
+        func(begin, end);
+        return;
+    }
+
+    size_t chunk_size = (count + chunks - 1) / chunks;
+    chunks = (count + chunk_size - 1) / chunk_size;
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+
+    for (size_t c = 0; c + 1 < chunks; c++)
+    {
+        auto chunk_begin = begin + c * chunk_size;
+        auto chunk_end = std::min(end, chunk_begin + chunk_size);
+        workers.emplace_back(func, chunk_begin, chunk_end);
+    }
+    func(begin + (chunks - 1) * chunk_size, end);
+
+    for (auto &worker : workers)
+        worker.join();
+}
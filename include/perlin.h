@@ -2,15 +2,28 @@
 
 #include "rtweekend.h"
 
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTW_PERLIN_SSE 1
+#include <emmintrin.h>
+#endif
+
 class perlin
 {
 public:
     perlin()
     {
-        ranvec = new vec3[point_count];
+        // Gradients are stored as padded float4s so a corner's gradient is a single SIMD load.
+        gradients = new float[point_count * 4];
         for (int i = 0; i < point_count; ++i)
         {
-            ranvec[i] = vec3::random(-1, 1).normalize();
+            auto g = vec3::random(-1, 1).normalize();
+            gradients[4 * i + 0] = g.x;
+            gradients[4 * i + 1] = g.y;
+            gradients[4 * i + 2] = g.z;
+            gradients[4 * i + 3] = 0;
         }
 
         perm_x = perlin_generate_perm();
@@ -20,30 +33,78 @@ public:
 
     ~perlin()
     {
-        delete[] ranvec;
+        delete[] gradients;
         delete[] perm_x;
         delete[] perm_y;
         delete[] perm_z;
     }
 
+    perlin(const perlin &) = delete;
+    perlin &operator=(const perlin &) = delete;
+
     double noise(const point3 &p) const
     {
-        auto u = p.x - floor(p.x);
-        auto v = p.y - floor(p.y);
-        auto w = p.z - floor(p.z);
-        auto i = static_cast<int>(floor(p.x));
-        auto j = static_cast<int>(floor(p.y));
-        auto k = static_cast<int>(floor(p.z));
-        vec3 c[2][2][2];
-
-        for (int di = 0; di < 2; di++)
-            for (int dj = 0; dj < 2; dj++)
-                for (int dk = 0; dk < 2; dk++)
-                    c[di][dj][dk] = ranvec[perm_x[(i + di) & 255] ^
-                                           perm_y[(j + dj) & 255] ^
-                                           perm_z[(k + dk) & 255]];
-
-        return perlin_interp(c, u, v, w);
+        auto fx = floor(p.x);
+        auto fy = floor(p.y);
+        auto fz = floor(p.z);
+        auto u = static_cast<float>(p.x - fx);
+        auto v = static_cast<float>(p.y - fy);
+        auto w = static_cast<float>(p.z - fz);
+        auto i = static_cast<int>(fx);
+        auto j = static_cast<int>(fy);
+        auto k = static_cast<int>(fz);
+
+        int x0 = perm_x[i & 255], x1 = perm_x[(i + 1) & 255];
+        int y0 = perm_y[j & 255], y1 = perm_y[(j + 1) & 255];
+        int z0 = perm_z[k & 255], z1 = perm_z[(k + 1) & 255];
+
+        // Smoothed weights for the trilinear blend of the eight corner contributions.
+        auto uu = u * u * (3 - 2 * u);
+        auto vv = v * v * (3 - 2 * v);
+        auto ww = w * w * (3 - 2 * w);
+
+        // Corner contributions for the four (dj,dk) corners, already blended along x.
+        float face[4];
+
+#ifdef RTW_PERLIN_SSE
+        // One SIMD lane per (dj,dk) corner; the di=0 and di=1 faces are evaluated side by side,
+        // so all eight gradient dot products take a handful of instructions.
+        auto a0 = _mm_loadu_ps(gradient(x0 ^ y0 ^ z0));
+        auto a1 = _mm_loadu_ps(gradient(x0 ^ y0 ^ z1));
+        auto a2 = _mm_loadu_ps(gradient(x0 ^ y1 ^ z0));
+        auto a3 = _mm_loadu_ps(gradient(x0 ^ y1 ^ z1));
+        auto b0 = _mm_loadu_ps(gradient(x1 ^ y0 ^ z0));
+        auto b1 = _mm_loadu_ps(gradient(x1 ^ y0 ^ z1));
+        auto b2 = _mm_loadu_ps(gradient(x1 ^ y1 ^ z0));
+        auto b3 = _mm_loadu_ps(gradient(x1 ^ y1 ^ z1));
+        _MM_TRANSPOSE4_PS(a0, a1, a2, a3); // a0 = gradient x per corner, a1 = y, a2 = z
+        _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+        auto dy = _mm_set_ps(v - 1, v - 1, v, v);
+        auto dz = _mm_set_ps(w - 1, w, w - 1, w);
+        auto yz0 = _mm_add_ps(_mm_mul_ps(a1, dy), _mm_mul_ps(a2, dz));
+        auto yz1 = _mm_add_ps(_mm_mul_ps(b1, dy), _mm_mul_ps(b2, dz));
+        auto d0 = _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(u)), yz0);
+        auto d1 = _mm_add_ps(_mm_mul_ps(b0, _mm_set1_ps(u - 1)), yz1);
+        _mm_storeu_ps(face, _mm_add_ps(d0, _mm_mul_ps(_mm_set1_ps(uu), _mm_sub_ps(d1, d0))));
+#else
+        const int corner_y[4] = {y0, y0, y1, y1};
+        const int corner_z[4] = {z0, z1, z0, z1};
+        for (int c = 0; c < 4; c++)
+        {
+            auto dy = v - (c >> 1);
+            auto dz = w - (c & 1);
+            auto g0 = gradient(x0 ^ corner_y[c] ^ corner_z[c]);
+            auto g1 = gradient(x1 ^ corner_y[c] ^ corner_z[c]);
+            auto d0 = g0[0] * u + g0[1] * dy + g0[2] * dz;
+            auto d1 = g1[0] * (u - 1) + g1[1] * dy + g1[2] * dz;
+            face[c] = d0 + uu * (d1 - d0);
+        }
+#endif
+
+        auto e0 = face[0] + ww * (face[1] - face[0]);
+        auto e1 = face[2] + ww * (face[3] - face[2]);
+        return e0 + vv * (e1 - e0);
     }
 
     double turb(const point3 &p, int depth = 7) const
@@ -62,13 +123,44 @@ public:
         return fabs(accum);
     }
 
+    // Batched forms: out[n] receives noise(points[n]) or turb(points[n], depth).
+    void noise(const point3 *points, double *out, size_t count) const
+    {
+        for (size_t n = 0; n < count; n++)
+            out[n] = noise(points[n]);
+    }
+
+    void turb(const point3 *points, double *out, size_t count, int depth = 7) const
+    {
+        // Octave by octave over the whole batch, so the gradient and permutation tables are
+        // walked with the same frequency for many points in a row.
+        std::vector<point3> scaled(points, points + count);
+        std::fill(out, out + count, 0.0);
+        auto weight = 1.0;
+
+        for (int i = 0; i < depth; i++)
+        {
+            for (size_t n = 0; n < count; n++)
+            {
+                out[n] += weight * noise(scaled[n]);
+                scaled[n] *= 2;
+            }
+            weight *= 0.5;
+        }
+
+        for (size_t n = 0; n < count; n++)
+            out[n] = fabs(out[n]);
+    }
+
 private:
     static const int point_count = 256;
-    vec3 *ranvec;
+    float *gradients;
     int *perm_x;
     int *perm_y;
     int *perm_z;
 
+    const float *gradient(int index) const { return gradients + 4 * index; }
+
     static int *perlin_generate_perm()
     {
         auto p = new int[point_count];
@@ -89,22 +181,4 @@ private:
             std::swap(p[i], p[target]);
         }
     }
-
-    static double perlin_interp(vec3 c[2][2][2], double u, double v, double w)
-    {
-        auto uu = u * u * (3 - 2 * u);
-        auto vv = v * v * (3 - 2 * v);
-        auto ww = w * w * (3 - 2 * w);
-        auto accum = 0.0;
-
-        for (int i = 0; i < 2; i++)
-            for (int j = 0; j < 2; j++)
-                for (int k = 0; k < 2; k++)
-                {
-                    vec3 weight_v(u - i, v - j, w - k);
-                    accum += (i * uu + (1 - i) * (1 - uu)) * (j * vv + (1 - j) * (1 - vv)) * (k * ww + (1 - k) * (1 - ww)) * dot(c[i][j][k], weight_v);
-                }
-
-        return accum;
-    }
-};
\ No newline at end of file
+};
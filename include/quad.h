@@ -3,6 +3,7 @@
 #include "rtweekend.h"
 
 #include "hittable.h"
+#include "material.h"
 
 class quad : public hittable
 {
@@ -11,6 +12,7 @@ public:
         : Q(_Q), u(_u), v(_v), mat(m)
     {
         auto n = cross(u, v);
+        area = n.length();
         normal = n.normalized();
         D = dot(normal, Q);
         w = n / dot(n, n);
@@ -26,6 +28,7 @@ public:
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
+        count_stat(&render_counters::quad_tests);
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -50,10 +53,63 @@ public:
         rec.t = t;
         rec.p = intersection;
         rec.mat = mat;
+        rec.primitive_id = id;
         rec.set_face_normal(r, normal);
+        rec.set_uv_footprint(r, u, v);
 
         return true;
     }
+    bool hit_interval(const ray &r, interval &crossings) const override
+    {
+        // A quad is crossed at most once. Only the plane test and the interior test of hit()
+        // are needed; the rest of the hit record is left alone.
+        count_stat(&render_counters::quad_tests);
+        auto denom = dot(normal, r.direction());
+        if (fabs(denom) < 1e-8)
+            return false;
+
+        auto t = (D - dot(normal, r.origin())) / denom;
+        vec3 planar_hitpt_vector = r.at(t) - Q;
+        hit_record rec;
+        if (!is_interior(dot(w, cross(planar_hitpt_vector, v)), dot(w, cross(u, planar_hitpt_vector)), rec))
+            return false;
+
+        crossings = interval(crossings, interval(t, t));
+        return true;
+    }
+
+    void collect_emitters(std::vector<const hittable *> &emitters) const override
+    {
+        if (mat && mat->is_emitter())
+            emitters.push_back(this);
+    }
+
+    vec3 random(const point3 &origin, const sample2d &s, double) const override
+    {
+        // A uniformly chosen point of the quad.
+        return Q + (s.u * u) + (s.v * v) - origin;
+    }
+
+    double pdf_value(const point3 &origin, const vec3 &direction, double time) const override
+    {
+        // Uniform density over the area, converted to solid angle at origin.
+        hit_record rec;
+        if (!this->hit(ray(origin, direction, time), interval(0.001, infinity), rec))
+            return 0;
+
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = fabs(dot(direction, rec.normal) / direction.length());
+        return (cosine > 0) ? distance_squared / (cosine * area) : 0;
+    }
+
+    double emitted_power() const override
+    {
+        // Both faces emit; the color at the centre stands for the whole quad.
+        if (!mat)
+            return 0;
+        return 2 * pi * area * luminance(mat->emitted(0.5, 0.5, Q + 0.5 * (u + v)));
+    }
+
     virtual bool is_interior(double a, double b, hit_record &rec) const
     {
         // Given the hit point in plane coordinates, return false if it is outside the
@@ -75,6 +131,7 @@ private:
     vec3 normal;
     double D;
     vec3 w;
+    double area;
 };
 
 inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat)
@@ -19,8 +19,29 @@ public:
         return orig + t * dir;
     }
 
+    // Camera rays also carry the rays offset by one sample spacing in image x and y, so that a
+    // hit can estimate how much of a texture a single sample covers.
+    void set_differentials(const point3 &rx_o, const vec3 &rx_d, const point3 &ry_o, const vec3 &ry_d)
+    {
+        differentials = true;
+        rx_orig = rx_o;
+        rx_dir = rx_d;
+        ry_orig = ry_o;
+        ry_dir = ry_d;
+    }
+
+    bool has_differentials() const { return differentials; }
+    point3 rx_origin() const { return rx_orig; }
+    vec3 rx_direction() const { return rx_dir; }
+    point3 ry_origin() const { return ry_orig; }
+    vec3 ry_direction() const { return ry_dir; }
+
 private:
     point3 orig;
     vec3 dir;
     double tm;
+
+    bool differentials = false;
+    point3 rx_orig, ry_orig;
+    vec3 rx_dir, ry_dir;
 };
\ No newline at end of file
@@ -0,0 +1,456 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "distributed.h"
+#include "net.h"
+#include "scenes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A long-running renderer that takes jobs over a Unix domain socket. Built scenes (with their
+// BVHs) stay cached between jobs, so a client pays for a scene once per daemon rather than
+// once per image. Jobs render in passes of a growing number of samples per pixel on every
+// core; after each pass the client gets the image so far, and the next pass goes to the
+// waiting job with the highest priority, so an urgent job overtakes a long one between passes.
+//
+// Protocol, one text line per message:
+//   client -> server   render <scene> [seed=N] [width=N] [spp=N] [depth=N] [priority=N]
+//                             [lookfrom=x,y,z] [lookat=x,y,z] [vfov=D]
+//                      cancel <id>
+//                      shutdown
+//   server -> client   queued <id>
+//                      image <id> <samples done> <samples per pixel> <bytes>, then a binary PPM
+//                      done <id> <seconds>
+//                      error <message>
+// <scene> may be quoted as by std::quoted, for a scene file path with spaces in it.
+
+struct render_request
+{
+    render_settings settings;        // 场景、种子与画质（0 表示使用场景默认值）
+    int priority = 0;                // 优先级（越大越先渲染）
+    std::optional<point3> lookfrom;  // 摄像机位置（不设置则用场景默认值）
+    std::optional<point3> lookat;    // 摄像机朝向（不设置则用场景默认值）
+    std::optional<double> vfov;      // 垂直视角（不设置则用场景默认值）
+
+    // Parses the arguments of a render line (everything after "render").
+    static bool parse(std::istream &in, render_request &request, std::string &error)
+    {
+        if (!(in >> std::quoted(request.settings.scene)))
+        {
+            error = "missing scene name";
+            return false;
+        }
+
+        auto parse_point = [](const std::string &text, std::optional<point3> &p)
+        {
+            double x, y, z;
+            char comma1, comma2;
+            std::istringstream in(text);
+            if (!(in >> x >> comma1 >> y >> comma2 >> z) || comma1 != ',' || comma2 != ',')
+                return false;
+            p = point3(x, y, z);
+            return true;
+        };
+
+        std::string option;
+        while (in >> option)
+        {
+            auto equals = option.find('=');
+            auto key = option.substr(0, equals);
+            auto value = (equals == std::string::npos) ? std::string() : option.substr(equals + 1);
+            bool ok = true;
+            try
+            {
+                if (value.empty())
+                    ok = false;
+                else if (key == "seed")
+                    request.settings.seed = static_cast<unsigned int>(std::stoul(value));
+                else if (key == "width")
+                    request.settings.image_width = std::stoi(value);
+                else if (key == "spp")
+                    request.settings.samples_per_pixel = std::stoi(value);
+                else if (key == "depth")
+                    request.settings.max_depth = std::stoi(value);
+                else if (key == "priority")
+                    request.priority = std::stoi(value);
+                else if (key == "lookfrom")
+                    ok = parse_point(value, request.lookfrom);
+                else if (key == "lookat")
+                    ok = parse_point(value, request.lookat);
+                else if (key == "vfov")
+                    request.vfov = std::stod(value);
+                else
+                    ok = false;
+            }
+            catch (const std::exception &)
+            {
+                ok = false; // Not a number
+            }
+
+            if (!ok)
+            {
+                error = "bad option '" + option + "'";
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+class render_server
+{
+public:
+    explicit render_server(std::string socket_path, size_t cache_size = 4)
+        : socket_path(std::move(socket_path)), cache_size(std::max<size_t>(1, cache_size))
+    {
+    }
+
+    // Serves until a client sends shutdown. Returns the process exit status.
+    int run()
+    {
+        listener server(socket_path);
+        if (!server.is_open())
+            return 1;
+        std::clog << "Render server listening on " << socket_path << '\n';
+
+        std::thread scheduler([this] { schedule(); });
+
+        struct session
+        {
+            shared_ptr<client> peer;
+            std::thread reader;
+        };
+        std::vector<session> sessions;
+
+        while (!stopping())
+        {
+            pollfd fd{server.handle(), 0, 0};
+            if (wait_readable(&fd, 1, 200) > 0)
+            {
+                auto link = server.accept();
+                if (link.is_open())
+                {
+                    auto peer = make_shared<client>(std::move(link));
+                    sessions.push_back({peer, std::thread([this, peer] { serve(peer); })});
+                }
+            }
+
+            // Threads of clients that have gone are finished; join them.
+            for (auto &s : sessions)
+                if (!s.peer->open && s.reader.joinable())
+                    s.reader.join();
+            sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                          [](const session &s) { return !s.reader.joinable(); }),
+                           sessions.end());
+        }
+
+        server.close();
+        scheduler.join();
+        for (auto &s : sessions)
+        {
+            s.peer->link.shutdown();
+            s.reader.join();
+        }
+        return 0;
+    }
+
+private:
+    struct client
+    {
+        connection link;
+        std::mutex send_mutex;       // Replies come from the reader and the scheduler
+        std::atomic<bool> open{true}; // False once the client has gone
+
+        explicit client(connection link) : link(std::move(link)) {}
+
+        bool send(const std::string &line, const std::string &payload = std::string())
+        {
+            std::lock_guard<std::mutex> lock(send_mutex);
+            return link.send_line(line) && link.send_all(payload.data(), payload.size());
+        }
+    };
+
+    struct job
+    {
+        long id;
+        render_request request;
+        shared_ptr<client> owner;
+        std::vector<color> sums; // Radiance summed over the samples done so far
+        camera cam;
+        int width = 0, height = 0;
+        int samples_done = 0;
+        int passes = 0;
+        bool cancelled = false;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    std::string socket_path;
+    size_t cache_size;
+
+    std::mutex mutex; // Guards everything below
+    std::condition_variable wake;
+    std::vector<shared_ptr<job>> jobs; // Queued and in progress
+    long next_id = 1;
+    bool stop = false;
+    std::list<std::pair<std::string, shared_ptr<const scene>>> cache; // Most recently used first
+
+    bool stopping()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stop;
+    }
+
+    void serve(shared_ptr<client> peer)
+    {
+        // One thread per client reads its requests; rendering happens on the scheduler.
+        std::string line;
+        while (peer->link.read_line(line))
+        {
+            std::istringstream in(line);
+            std::string command, error;
+            in >> command;
+
+            if (command == "render")
+            {
+                auto j = make_shared<job>();
+                if (!render_request::parse(in, j->request, error))
+                {
+                    peer->send("error " + error);
+                    continue;
+                }
+                j->owner = peer;
+                j->queued = std::chrono::steady_clock::now();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    j->id = next_id++;
+                    jobs.push_back(j);
+                }
+                peer->send("queued " + std::to_string(j->id));
+                wake.notify_one();
+            }
+            else if (command == "cancel")
+            {
+                long id = 0;
+                in >> id;
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &j : jobs)
+                    if (j->id == id && j->owner == peer)
+                        j->cancelled = true;
+            }
+            else if (command == "shutdown")
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stop = true;
+                }
+                wake.notify_one();
+                break;
+            }
+            else
+                peer->send("error unknown request '" + command + "'");
+        }
+
+        peer->open = false;
+        wake.notify_one();
+    }
+
+    void schedule()
+    {
+        while (true)
+        {
+            shared_ptr<job> next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stop || !jobs.empty(); });
+                if (stop)
+                    return;
+
+                // Jobs whose client has gone or cancelled them are dropped. Of the rest, the
+                // highest priority goes next, and the oldest among equals.
+                jobs.erase(std::remove_if(jobs.begin(), jobs.end(),
+                                          [](const shared_ptr<job> &j) { return j->cancelled || !j->owner->open; }),
+                           jobs.end());
+                if (jobs.empty())
+                    continue;
+                next = *std::min_element(jobs.begin(), jobs.end(),
+                                         [](const shared_ptr<job> &a, const shared_ptr<job> &b)
+                                         {
+                                             return a->request.priority != b->request.priority
+                                                        ? a->request.priority > b->request.priority
+                                                        : a->id < b->id;
+                                         });
+            }
+
+            bool finished = !render_pass(*next);
+            if (!finished)
+                finished = next->samples_done >= next->cam.samples_per_pixel;
+            if (finished)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.erase(std::find(jobs.begin(), jobs.end(), next));
+            }
+        }
+    }
+
+    shared_ptr<const scene> cached_scene(const render_settings &settings)
+    {
+        // Scenes are keyed by what goes into building them; camera and quality are per job.
+        auto key = settings.scene + ' ' + std::to_string(settings.seed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = cache.begin(); it != cache.end(); ++it)
+            {
+                if (it->first != key)
+                    continue;
+                cache.splice(cache.begin(), cache, it);
+                return cache.front().second;
+            }
+        }
+
+        auto built = make_shared<scene>();
+        auto build_settings = render_settings{settings.scene, settings.seed};
+        {
+            scoped_phase timer(render_phase::scene_build);
+            if (!build_scene(build_settings, *built))
+                return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        cache.emplace_front(key, built);
+        if (cache.size() > cache_size)
+            cache.pop_back();
+        return built;
+    }
+
+    bool render_pass(job &j)
+    {
+        // Renders the job's next pass and streams the image so far. False if the job is over
+        // early: its scene does not exist or its client has gone.
+        auto &request = j.request;
+        auto built = cached_scene(request.settings);
+        if (!built)
+        {
+            j.owner->send("error unknown scene '" + request.settings.scene + "'");
+            return false;
+        }
+
+        if (j.passes == 0)
+        {
+            j.cam = built->cam;
+            if (request.settings.image_width > 0)
+                j.cam.image_width = request.settings.image_width;
+            if (request.settings.samples_per_pixel > 0)
+                j.cam.samples_per_pixel = request.settings.samples_per_pixel;
+            if (request.settings.max_depth > 0)
+                j.cam.max_depth = request.settings.max_depth;
+            if (request.lookfrom)
+                j.cam.lookfrom = *request.lookfrom;
+            if (request.lookat)
+                j.cam.lookat = *request.lookat;
+            if (request.vfov)
+                j.cam.vfov = *request.vfov;
+            j.cam.show_progress = false;
+            j.width = j.cam.image_width;
+        }
+
+        // Passes double from one sample per pixel, up to 64: quick previews, then long passes
+        // that keep the per-pass overhead of sending images small.
+        auto count = std::min({1 << std::min(j.passes, 6), 64, j.cam.samples_per_pixel - j.samples_done});
+        auto pass = j.cam.render_region(built->world, 0, 0, std::numeric_limits<int>::max(),
+                                        std::numeric_limits<int>::max(), j.samples_done, count);
+        if (j.passes == 0)
+        {
+            j.height = static_cast<int>(pass.size() / j.width);
+            j.sums.assign(pass.size(), color(0, 0, 0));
+        }
+        for (size_t p = 0; p < pass.size(); p++)
+            j.sums[p] += pass[p];
+        j.samples_done += count;
+        j.passes++;
+
+        std::string image = "P6\n" + std::to_string(j.width) + ' ' + std::to_string(j.height) + "\n255\n";
+        auto header = image.size();
+        image.resize(header + 3 * j.sums.size());
+        for (size_t p = 0; p < j.sums.size(); p++)
+            color_to_bytes(j.sums[p], j.samples_done, reinterpret_cast<unsigned char *>(&image[header + 3 * p]));
+
+        std::ostringstream line;
+        line << "image " << j.id << ' ' << j.samples_done << ' ' << j.cam.samples_per_pixel << ' ' << image.size();
+        if (!j.owner->send(line.str(), image))
+            return false;
+
+        if (j.samples_done >= j.cam.samples_per_pixel)
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - j.queued;
+            j.owner->send("done " + std::to_string(j.id) + ' ' + std::to_string(elapsed.count()));
+        }
+        return true;
+    }
+};
+
+// Sends one render request to a server and writes each image it streams back to out_path,
+// replacing the previous one. Returns the process exit status.
+inline int submit_render(const std::string &socket_path, const std::string &request, const std::string &out_path)
+{
+    auto link = connect_unix(socket_path);
+    if (!link.is_open())
+        return 1;
+    if (!link.send_line(request))
+    {
+        std::cerr << "ERROR: Could not send the request.\n";
+        return 1;
+    }
+
+    std::string line;
+    while (link.read_line(line))
+    {
+        std::istringstream in(line);
+        std::string reply;
+        in >> reply;
+        if (reply == "image")
+        {
+            long id;
+            int done, total;
+            size_t bytes;
+            in >> id >> done >> total >> bytes;
+            std::string image(bytes, '\0');
+            if (!link.read_bytes(&image[0], bytes))
+                break;
+
+            std::ofstream out(out_path, std::ios::binary);
+            if (!out.write(image.data(), image.size()))
+            {
+                std::cerr << "\nERROR: Could not write image to '" << out_path << "'.\n";
+                return 1;
+            }
+            std::clog << "\rJob " << id << ": " << done << " / " << total << " samples per pixel" << std::flush;
+        }
+        else if (reply == "done")
+        {
+            std::clog << "\n" << line << " s\n";
+            return 0;
+        }
+        else if (reply == "error")
+        {
+            std::cerr << "\nERROR: Server: " << line.substr(6) << ".\n";
+            return 1;
+        }
+    }
+
+    std::cerr << "\nERROR: Lost the connection to the server.\n";
+    return 1;
+}
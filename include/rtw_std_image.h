@@ -15,9 +15,9 @@
 class rtw_image
 {
 public:
-    rtw_image() : data(nullptr) {}
+    rtw_image() : data(nullptr), fdata(nullptr) {}
 
-    rtw_image(const char *image_filename)
+    rtw_image(const char *image_filename) : data(nullptr), fdata(nullptr)
     {
         // Loads image data from the specified file. If the RTW_IMAGES environment variable is
         // defined, looks only in that directory for the image file. If the image was not found,
@@ -52,19 +52,33 @@ public:
         std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
     }
 
-    ~rtw_image() { STBI_FREE(data); }
+    ~rtw_image()
+    {
+        STBI_FREE(data);
+        STBI_FREE(fdata);
+    }
 
     bool load(const std::string filename)
     {
         // Loads image data from the given file name. Returns true if the load succeeded.
+        // High dynamic range files (Radiance .hdr) keep their linear float values; every
+        // other format is loaded as 8-bit sRGB.
         auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
+        if (stbi_is_hdr(filename.c_str()))
+        {
+            fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
+            bytes_per_scanline = image_width * bytes_per_pixel;
+            return fdata != nullptr;
+        }
+
         data = stbi_load(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
         bytes_per_scanline = image_width * bytes_per_pixel;
         return data != nullptr;
     }
 
-    int width() const { return (data == nullptr) ? 0 : image_width; }
-    int height() const { return (data == nullptr) ? 0 : image_height; }
+    int width() const { return (data == nullptr && fdata == nullptr) ? 0 : image_width; }
+    int height() const { return (data == nullptr && fdata == nullptr) ? 0 : image_height; }
+    bool is_hdr() const { return fdata != nullptr; }
 
     const unsigned char *pixel_data(int x, int y) const
     {
@@ -79,9 +93,24 @@ public:
         return data + y * bytes_per_scanline + x * bytes_per_pixel;
     }
 
+    const float *hdr_pixel_data(int x, int y) const
+    {
+        // Return the address of the three linear floats of the pixel at x,y of an HDR image
+        // (or magenta if the image is not HDR).
+        static float magenta[] = {1, 0, 1};
+        if (fdata == nullptr)
+            return magenta;
+
+        x = clamp(x, 0, image_width);
+        y = clamp(y, 0, image_height);
+
+        return fdata + y * bytes_per_scanline + x * bytes_per_pixel;
+    }
+
 private:
     const int bytes_per_pixel = 3;
     unsigned char *data;
+    float *fdata;
     int image_width, image_height;
     int bytes_per_scanline;
 
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <cmath>
 #include <limits>
 #include <memory>
+#include <random>
 
 // Usings
 
@@ -22,10 +24,33 @@ inline double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
+inline std::atomic<unsigned int> &next_random_seed()
+{
+    static std::atomic<unsigned int> next_seed{1};
+    return next_seed;
+}
+
+inline std::mt19937 &random_generator()
+{
+    // Every thread draws from its own generator, seeded in the order threads first ask for a
+    // number, so parallel renders don't share RNG state.
+    thread_local std::mt19937 generator(next_random_seed()++);
+    return generator;
+}
+
+inline void seed_random(unsigned int seed)
+{
+    // Restarts the calling thread's generator at seed; threads that draw their first number
+    // afterwards get seed + 1, seed + 2, ... Single-threaded runs are then reproducible.
+    random_generator().seed(seed);
+    next_random_seed() = seed + 1;
+}
+
 inline double random_double()
 {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(random_generator());
 }
 
 inline double random_double(double min, double max)
@@ -0,0 +1,436 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Sample generators for the camera and the materials. A sampler hands out the numbers of one
+// camera sample as a sequence of dimensions: 2D pixel jitter, 2D lens position, 1D time, then
+// for every bounce a 2D direction, a 1D choice, a 2D environment sample, and a 1D light choice
+// with a 2D point on that light. The camera fixes where each bounce starts with
+// set_sample_dimension(), so a bounce always sees the same dimensions whatever earlier
+// bounces consumed.
+
+enum class sampler_type
+{
+    independent, // Uncorrelated random_double() draws
+    stratified,  // Correlated multi-jittered: every sample in its own stratum of each dimension
+    sobol,       // Owen-scrambled Sobol (0,2)-sequence, padded across dimension pairs
+    blue_noise   // A shared Sobol sequence, shifted per pixel by a blue-noise mask
+};
+
+class sampler
+{
+public:
+    explicit sampler(unsigned int seed = 0) : stream_seed(seed) {}
+    virtual ~sampler() = default;
+
+    // Begins sample `index` of pixel (i,j) at dimension zero.
+    void start_sample(int i, int j, int index)
+    {
+        pixel_x = i;
+        pixel_y = j;
+        sample_index = index;
+        dimension = 0;
+        stream_position = 0;
+    }
+
+    void set_dimension(int d) { dimension = d; }
+
+    double get_1d() { return value_1d(dimension++); }
+    sample2d get_2d() { return value_2d(dimension++); }
+
+    // Uniform numbers outside the dimension layout, for code that needs an unbounded count
+    // per bounce (delta tracking in media). Hashed from the pixel, the sample index and how
+    // many came before, so a sample draws the same ones in whatever thread or process renders it.
+    double get_random()
+    {
+        auto position = (static_cast<std::uint64_t>(stream_seed) << 32) | stream_position++;
+        return to_unit(hash(pixel_x, pixel_y, sample_index, position));
+    }
+
+protected:
+    static constexpr double one_minus_epsilon = 0x1.fffffffffffffp-1;
+
+    int pixel_x = 0, pixel_y = 0;
+    int sample_index = 0;
+    int dimension = 0;
+    unsigned int stream_seed;
+    std::uint32_t stream_position = 0;
+
+    virtual double value_1d(int d) = 0;
+    virtual sample2d value_2d(int d) = 0;
+
+    static std::uint32_t hash(std::uint64_t a, std::uint64_t b = 0, std::uint64_t c = 0, std::uint64_t d = 0)
+    {
+        // MurmurHash3 finalizer over a simple combination of the inputs.
+        auto v = a * 0x9e3779b97f4a7c15ull ^ (b + 0x632be59bd9b4e019ull) * 0xbf58476d1ce4e5b9ull ^
+                 (c + 0x94d049bb133111ebull) * 0xd6e8feb86659fd93ull ^ (d + 0x2545f4914f6cdd1dull) * 0xff51afd7ed558ccdull;
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdull;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ull;
+        v ^= v >> 33;
+        return static_cast<std::uint32_t>(v);
+    }
+
+    static double to_unit(std::uint32_t bits) { return std::fmin(bits * 0x1p-32, one_minus_epsilon); }
+};
+
+class independent_sampler : public sampler
+{
+protected:
+    double value_1d(int) override { return random_double(); }
+    sample2d value_2d(int) override { return {random_double(), random_double()}; }
+};
+
+class stratified_sampler : public sampler
+{
+public:
+    // Correlated multi-jittered sampling (Kensler 2013): for any sample count the samples of a
+    // pixel fall one per row and one per column of a jittered grid, and one per stratum in 1D.
+    // Each pixel and dimension gets its own permutation, so dimensions stay uncorrelated.
+    stratified_sampler(int samples_per_pixel, unsigned int seed)
+        : sampler(seed), count(std::max(1, samples_per_pixel)), seed(seed)
+    {
+        columns = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(count))));
+        rows = (count + columns - 1) / columns;
+    }
+
+protected:
+    double value_1d(int d) override
+    {
+        auto pattern = hash(pixel_x, pixel_y, d, seed);
+        auto stratum = permute(static_cast<std::uint32_t>(sample_index) % count, count, pattern);
+        return std::fmin((stratum + jitter(sample_index, pattern * 0x68bc21ebu)) / count, one_minus_epsilon);
+    }
+
+    sample2d value_2d(int d) override
+    {
+        auto pattern = hash(pixel_x, pixel_y, d, seed);
+        auto s = permute(static_cast<std::uint32_t>(sample_index) % count, count, pattern * 0x51633e2du);
+        auto sx = permute(s % columns, columns, pattern * 0xa511e9b3u);
+        auto sy = permute(s / columns, rows, pattern * 0x63d83595u);
+        auto jx = jitter(s, pattern * 0xa399d265u);
+        auto jy = jitter(s, pattern * 0x711ad6a5u);
+        return {std::fmin((s % columns + (sy + jx) / rows) / columns, one_minus_epsilon),
+                std::fmin((s / columns + (sx + jy) / columns) / rows, one_minus_epsilon)};
+    }
+
+private:
+    std::uint32_t count;
+    std::uint32_t columns, rows;
+    unsigned int seed;
+
+    static std::uint32_t permute(std::uint32_t i, std::uint32_t l, std::uint32_t p)
+    {
+        // A hashed permutation of [0, l), cycle-walking over the next power of two.
+        auto w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do
+        {
+            i ^= p;
+            i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    static double jitter(std::uint32_t i, std::uint32_t p)
+    {
+        i ^= p;
+        i ^= i >> 17;
+        i ^= i >> 10;
+        i *= 0xb36534e5;
+        i ^= i >> 12;
+        i ^= i >> 21;
+        i *= 0x93fc4795;
+        i ^= 0xdf6e307f;
+        i ^= i >> 17;
+        i *= 1 | p >> 18;
+        return to_unit(i);
+    }
+};
+
+class sobol_sampler : public sampler
+{
+public:
+    // Owen-scrambled Sobol points (Burley 2020). Every dimension pair uses the first two
+    // Sobol dimensions, which form a (0,2)-sequence, with its own hashed shuffle of the sample
+    // index and its own nested uniform scramble, so any prefix of the samples is well
+    // stratified in every pair and the pairs are uncorrelated.
+    explicit sobol_sampler(unsigned int seed) : sampler(seed), seed(seed) {}
+
+protected:
+    unsigned int seed;
+
+    double value_1d(int d) override { return value_2d(d).u; }
+
+    sample2d value_2d(int d) override { return owen_sobol(sample_index, hash(pixel_x, pixel_y, d, seed)); }
+
+    static sample2d owen_sobol(std::uint32_t index, std::uint32_t pattern)
+    {
+        auto shuffled = nested_uniform_scramble(index, pattern);
+        auto x = nested_uniform_scramble(sobol_dimension_0(shuffled), hash(pattern, 1));
+        auto y = nested_uniform_scramble(sobol_dimension_1(shuffled), hash(pattern, 2));
+        return {to_unit(x), to_unit(y)};
+    }
+
+private:
+    static std::uint32_t reverse_bits(std::uint32_t x)
+    {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    static std::uint32_t sobol_dimension_0(std::uint32_t index) { return reverse_bits(index); }
+
+    static std::uint32_t sobol_dimension_1(std::uint32_t index)
+    {
+        // Direction numbers of the second Sobol dimension: v[0] = 2^31, v[k] = v[k-1] ^ (v[k-1] >> 1).
+        std::uint32_t result = 0;
+        for (std::uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                result ^= v;
+        return result;
+    }
+
+    static std::uint32_t nested_uniform_scramble(std::uint32_t x, std::uint32_t seed)
+    {
+        // Owen scrambling: a hash in which every bit depends only on the bits above it
+        // (Laine-Karras), applied to the bit-reversed value.
+        x = reverse_bits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverse_bits(x);
+    }
+};
+
+class blue_noise_sampler : public sobol_sampler
+{
+public:
+    // Every pixel takes the same Sobol sequence, offset (Cranley-Patterson rotation) by a
+    // value from a blue-noise mask that is shifted per dimension (Georgiev and Fajardo 2016).
+    // Neighbouring pixels then err in opposite directions, so the remaining noise is high
+    // frequency, which looks finer and blurs away more easily.
+    explicit blue_noise_sampler(unsigned int seed) : sobol_sampler(seed) {}
+
+protected:
+    sample2d value_2d(int d) override
+    {
+        auto shift = hash(d, seed);
+        auto point = owen_sobol(sample_index, hash(d, seed, 1));
+        return {rotate(point.u, mask_value(pixel_x + (shift & 0xff), pixel_y + ((shift >> 8) & 0xff))),
+                rotate(point.v, mask_value(pixel_x + ((shift >> 16) & 0xff), pixel_y + (shift >> 24)))};
+    }
+
+private:
+    static constexpr int mask_size = 64;
+
+    static double rotate(double x, double offset)
+    {
+        x += offset;
+        return std::fmin((x >= 1) ? x - 1 : x, one_minus_epsilon);
+    }
+
+    static double mask_value(int x, int y)
+    {
+        static const std::vector<float> mask = void_and_cluster();
+        return mask[static_cast<size_t>(y & (mask_size - 1)) * mask_size + (x & (mask_size - 1))];
+    }
+
+    static std::vector<float> void_and_cluster()
+    {
+        // Ulichney's void-and-cluster method: rank every texel of a toroidal grid so that each
+        // prefix of the ranking is as evenly spread as possible, using a Gaussian-filtered
+        // energy to find the tightest cluster and the largest void. Built once, in a few ms.
+        const int size = mask_size * mask_size;
+        const int radius = 6;
+        const double sigma = 1.9;
+        std::vector<double> kernel((2 * radius + 1) * (2 * radius + 1));
+        for (int dy = -radius; dy <= radius; dy++)
+            for (int dx = -radius; dx <= radius; dx++)
+                kernel[(dy + radius) * (2 * radius + 1) + dx + radius] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+
+        std::vector<char> pattern(size, 0);
+        std::vector<double> energy(size, 0.0);
+        auto splat = [&](std::vector<double> &field, int p, double sign)
+        {
+            int px = p % mask_size, py = p / mask_size;
+            for (int dy = -radius; dy <= radius; dy++)
+                for (int dx = -radius; dx <= radius; dx++)
+                {
+                    int x = (px + dx + mask_size) & (mask_size - 1);
+                    int y = (py + dy + mask_size) & (mask_size - 1);
+                    field[y * mask_size + x] += sign * kernel[(dy + radius) * (2 * radius + 1) + dx + radius];
+                }
+        };
+        auto extreme = [&](const std::vector<double> &field, char state, bool largest)
+        {
+            int best = -1;
+            for (int p = 0; p < size; p++)
+                if (pattern[p] == state && (best < 0 || (largest ? field[p] > field[best] : field[p] < field[best])))
+                    best = p;
+            return best;
+        };
+
+        // Initial pattern: a tenth of the texels at random, relaxed until the tightest
+        // cluster is also the largest void.
+        std::mt19937 generator(7);
+        int ones = 0;
+        while (ones < size / 10)
+        {
+            auto p = static_cast<int>(generator() % size);
+            if (!pattern[p])
+            {
+                pattern[p] = 1;
+                splat(energy, p, 1);
+                ones++;
+            }
+        }
+        for (;;)
+        {
+            auto cluster = extreme(energy, 1, true);
+            pattern[cluster] = 0;
+            splat(energy, cluster, -1);
+            auto gap = extreme(energy, 0, false);
+            pattern[gap] = 1;
+            splat(energy, gap, 1);
+            if (gap == cluster)
+                break;
+        }
+
+        std::vector<int> rank(size);
+        auto initial_pattern = pattern;
+        auto initial_energy = energy;
+
+        // Phase 1: remove the tightest clusters of the initial pattern, ranking downwards.
+        for (int r = ones - 1; r >= 0; r--)
+        {
+            auto cluster = extreme(energy, 1, true);
+            pattern[cluster] = 0;
+            splat(energy, cluster, -1);
+            rank[cluster] = r;
+        }
+
+        // Phase 2: from the initial pattern, fill the largest voids up to half the texels.
+        pattern = initial_pattern;
+        energy = initial_energy;
+        int r = ones;
+        for (; r < size / 2; r++)
+        {
+            auto gap = extreme(energy, 0, false);
+            pattern[gap] = 1;
+            splat(energy, gap, 1);
+            rank[gap] = r;
+        }
+
+        // Phase 3: the empty texels are now the minority; fill their tightest clusters.
+        std::vector<double> empty_energy(size, 0.0);
+        for (int p = 0; p < size; p++)
+            if (!pattern[p])
+                splat(empty_energy, p, 1);
+        for (; r < size; r++)
+        {
+            auto cluster = extreme(empty_energy, 0, true);
+            pattern[cluster] = 1;
+            splat(empty_energy, cluster, -1);
+            rank[cluster] = r;
+        }
+
+        std::vector<float> mask(size);
+        for (int p = 0; p < size; p++)
+            mask[p] = (rank[p] + 0.5f) / size;
+        return mask;
+    }
+};
+
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, int samples_per_pixel, unsigned int seed)
+{
+    switch (type)
+    {
+    case sampler_type::stratified:
+        return std::make_unique<stratified_sampler>(samples_per_pixel, seed);
+    case sampler_type::sobol:
+        return std::make_unique<sobol_sampler>(seed);
+    case sampler_type::blue_noise:
+        return std::make_unique<blue_noise_sampler>(seed);
+    default:
+        return std::make_unique<independent_sampler>();
+    }
+}
+
+// The sampler the calling thread is rendering with, if any. Code that needs random numbers
+// for a camera sample asks it through sample_1d() and sample_2d(), which fall back to
+// random_double() when no sampler is active.
+inline sampler *&active_sampler()
+{
+    thread_local sampler *current = nullptr;
+    return current;
+}
+
+inline double sample_1d()
+{
+    auto s = active_sampler();
+    return s ? s->get_1d() : random_double();
+}
+
+// A number from the sampler's stream outside the dimension layout (see sampler::get_random()).
+inline double sample_random()
+{
+    auto s = active_sampler();
+    return s ? s->get_random() : random_double();
+}
+
+inline sample2d sample_2d()
+{
+    auto s = active_sampler();
+    return s ? s->get_2d() : sample2d{random_double(), random_double()};
+}
+
+inline void set_sample_dimension(int d)
+{
+    if (auto s = active_sampler())
+        s->set_dimension(d);
+}
+
+inline vec3 sample_unit_vector()
+{
+    return uniform_sphere(sample_2d());
+}
+
+inline vec3 sample_in_unit_disk()
+{
+    return concentric_disk(sample_2d());
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Closed-form warps from a point of the unit square to the common sampling domains. None of
+// them loops or rejects, so stratified and low-discrepancy samples keep their structure, and
+// each comes with the density it produces.
+
+struct sample2d
+{
+    double u, v;
+};
+
+inline vec3 uniform_sphere(const sample2d &s)
+{
+    // Uniform direction on the unit sphere: z uniform in [-1,1], azimuth uniform.
+    auto z = 1 - 2 * s.u;
+    auto r = std::sqrt(std::fmax(0.0, 1 - z * z));
+    auto phi = static_cast<float>(2 * pi * s.v);
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+inline double uniform_sphere_pdf()
+{
+    return 1 / (4 * pi);
+}
+
+inline vec3 concentric_disk(const sample2d &s)
+{
+    // Uniform point in the unit disk (z = 0), by Shirley and Chiu's concentric mapping, which
+    // keeps neighbouring samples neighbours. The wedge is chosen by selects, not branches.
+    auto a = 2 * s.u - 1;
+    auto b = 2 * s.v - 1;
+    auto use_a = std::fabs(a) > std::fabs(b);
+    auto r = use_a ? a : b;
+    auto phi = use_a ? (pi / 4) * (b / a) : (pi / 2) - (pi / 4) * (a / b);
+    if (r == 0)
+        phi = 0;
+    auto angle = static_cast<float>(phi); // Single precision is plenty for a direction
+    return vec3(r * std::cos(angle), r * std::sin(angle), 0);
+}
+
+inline vec3 cosine_hemisphere(const sample2d &s)
+{
+    // Cosine-weighted direction about +z (Malley's method: a disk sample lifted onto the
+    // hemisphere).
+    auto d = concentric_disk(s);
+    auto z = std::sqrt(std::fmax(0.0, 1.0 - d.x * d.x - d.y * d.y));
+    return vec3(d.x, d.y, z);
+}
+
+inline double cosine_hemisphere_pdf(double cos_theta)
+{
+    return std::fmax(0.0, cos_theta) / pi;
+}
+
+class onb
+{
+public:
+    // Orthonormal basis with w along n (Duff et al. 2017: branch-free, no normalization).
+    explicit onb(const vec3 &n) : w(n)
+    {
+        auto sign = std::copysign(1.0f, n.z);
+        auto a = -1.0f / (sign + n.z);
+        auto b = n.x * n.y * a;
+        u = vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        v = vec3(b, sign + n.y * n.y * a, -n.y);
+    }
+
+    vec3 local(const vec3 &a) const { return a.x * u + a.y * v + a.z * w; }
+
+    vec3 u, v, w;
+};
+
+class piecewise_constant_1d
+{
+public:
+    // Density proportional to a non-negative step function over [0,1), sampled by inverting
+    // its CDF. If every value is zero the density is uniform.
+    piecewise_constant_1d() = default;
+
+    explicit piecewise_constant_1d(const std::vector<double> &f) : func(f), cdf(f.size() + 1)
+    {
+        auto n = f.size();
+        cdf[0] = 0;
+        for (size_t i = 0; i < n; i++)
+            cdf[i + 1] = cdf[i] + std::fmax(0.0, f[i]) / n;
+        integral = cdf[n];
+
+        for (size_t i = 1; i <= n; i++)
+            cdf[i] = (integral > 0) ? cdf[i] / integral : static_cast<double>(i) / n;
+        if (integral <= 0)
+            std::fill(func.begin(), func.end(), 1.0);
+    }
+
+    size_t size() const { return func.size(); }
+
+    // Integral of the step function over [0,1).
+    double total() const { return integral; }
+
+    double sample(double u, double &pdf, size_t &bin) const
+    {
+        // Returns a point of [0,1); pdf receives its density and bin the step it lies in.
+        auto it = std::upper_bound(cdf.begin(), cdf.end(), u);
+        bin = std::min<size_t>(std::max<std::ptrdiff_t>(0, (it - cdf.begin()) - 1), func.size() - 1);
+
+        auto width = cdf[bin + 1] - cdf[bin];
+        auto du = (width > 0) ? (u - cdf[bin]) / width : 0.5;
+        pdf = density(bin);
+        return std::fmin((bin + du) / func.size(), 1 - 1e-9);
+    }
+
+    double density(size_t bin) const
+    {
+        return (integral > 0) ? std::fmax(0.0, func[bin]) / integral : 1.0;
+    }
+
+private:
+    std::vector<double> func;
+    std::vector<double> cdf;
+    double integral = 0;
+};
+
+class piecewise_constant_2d
+{
+public:
+    // Density over [0,1)^2 proportional to a width x height grid of non-negative values (row
+    // major, row 0 at v = 0): v is drawn from the row sums, then u from the chosen row.
+    piecewise_constant_2d() = default;
+
+    piecewise_constant_2d(const std::vector<double> &f, int width, int height)
+    {
+        rows.reserve(height);
+        std::vector<double> row_totals(height);
+        for (int y = 0; y < height; y++)
+        {
+            rows.emplace_back(std::vector<double>(f.begin() + static_cast<size_t>(y) * width,
+                                                  f.begin() + static_cast<size_t>(y + 1) * width));
+            row_totals[y] = rows.back().total();
+        }
+        marginal = piecewise_constant_1d(row_totals);
+    }
+
+    sample2d sample(const sample2d &s, double &pdf) const
+    {
+        double pdf_v, pdf_u;
+        size_t y, x;
+        auto v = marginal.sample(s.v, pdf_v, y);
+        auto u = rows[y].sample(s.u, pdf_u, x);
+        pdf = pdf_v * pdf_u;
+        return {u, v};
+    }
+
+    double density(double u, double v) const
+    {
+        auto y = std::min<size_t>(static_cast<size_t>(std::fmax(0.0, v) * rows.size()), rows.size() - 1);
+        auto &row = rows[y];
+        auto x = std::min<size_t>(static_cast<size_t>(std::fmax(0.0, u) * row.size()), row.size() - 1);
+        return marginal.density(y) * row.density(x);
+    }
+
+private:
+    std::vector<piecewise_constant_1d> rows;
+    piecewise_constant_1d marginal;
+};
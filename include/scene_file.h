@@ -0,0 +1,551 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "scenes.h"
+
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Scenes as text, loaded without recompiling. A file is a sequence of statements separated
+// by whitespace; # starts a comment that runs to the end of the line, and "quoted strings"
+// may hold spaces.
+//
+//   camera { <setting>... }      width N, aspect A (or A/B), spp N, depth N, vfov D,
+//                                lookfrom/lookat/vup x y z, defocus_angle D, focus_dist D,
+//                                background r g b, environment "<file>" [intensity]
+//   texture <name> <texture>     names a texture
+//   material <name> <material>   names a material
+//   object <name> <object>       names an object without adding it to the world
+//   <object>                     adds an object to the world
+//
+//   <texture>  := r g b | solid r g b | checker <scale> <texture> <texture>
+//               | image "<file>" | noise <scale> | <name>
+//   <material> := lambertian <texture> | metal r g b <fuzz> | dielectric <index>
+//               | diffuse_light <texture> | isotropic <texture> | <name>
+//   <object>   := sphere x y z <radius> <material>
+//               | moving_sphere x y z x y z <radius> <material>
+//               | quad x y z ux uy uz vx vy vz <material>
+//               | box x y z x y z <material>
+//               | constant_medium <density> <texture> <object>
+//               | translate x y z <object> | rotate_y <degrees> <object>
+//               | group { <object>... } | bvh { <object>... } | <name>
+//
+// Textures and materials written out in full are shared with every identical one, named or
+// not, so a generated file that repeats "lambertian 0.73 0.73 0.73" on each of a million
+// spheres makes one material. The world's top level is put in a BVH.
+
+class scene_parser
+{
+public:
+    // Parses the text of a scene file into s. filename is only used in error messages.
+    bool parse(std::string_view text, const std::string &filename, scene &s)
+    {
+        pos = text.data();
+        end = text.data() + text.size();
+        line = 1;
+        file = filename;
+        failed = false;
+
+        hittable_list world;
+        std::string_view token;
+        while (next(token))
+        {
+            if (token == "camera")
+            {
+                if (!parse_camera(s.cam))
+                    return false;
+            }
+            else if (token == "texture" || token == "material" || token == "object")
+            {
+                std::string_view name;
+                if (!next(name) || !is_name(name))
+                    return error("expected a name after '" + std::string(token) + "', found '" +
+                                 std::string(name) + "'");
+                auto key = std::string(name);
+                if (named_textures.count(key) || named_materials.count(key) || named_objects.count(key))
+                    return error("'" + key + "' is already defined");
+
+                if (token == "texture")
+                {
+                    if (!(named_textures[key] = parse_texture()))
+                        return false;
+                }
+                else if (token == "material")
+                {
+                    if (!(named_materials[key] = parse_material()))
+                        return false;
+                }
+                else if (!(named_objects[key] = parse_object()))
+                    return false;
+            }
+            else
+            {
+                auto object = parse_object(token);
+                if (!object)
+                    return false;
+                world.add(object);
+            }
+        }
+        if (failed) // next() stopped at a malformed token, not the end of the file
+            return false;
+
+        s.world = world.objects.empty() ? world : hittable_list(make_shared<bvh_node>(world));
+        return true;
+    }
+
+private:
+    const char *pos = nullptr;
+    const char *end = nullptr;
+    int line = 1;
+    std::string file;
+    bool failed = false; // An error has been reported; next() finds no more tokens
+
+    std::unordered_map<std::string, shared_ptr<texture>> named_textures;
+    std::unordered_map<std::string, shared_ptr<material>> named_materials;
+    std::unordered_map<std::string, shared_ptr<hittable>> named_objects;
+    std::unordered_map<std::string, shared_ptr<texture>> textures;   // By definition, for sharing
+    std::unordered_map<std::string, shared_ptr<material>> materials; // By definition, for sharing
+
+    bool error(const std::string &message)
+    {
+        // Only the first error is reported; the others follow from it.
+        if (!failed)
+            std::cerr << "ERROR: " << file << ':' << line << ": " << message << ".\n";
+        failed = true;
+        return false;
+    }
+
+    std::nullptr_t fail(const std::string &message)
+    {
+        error(message);
+        return nullptr;
+    }
+
+    bool next(std::string_view &token)
+    {
+        if (failed)
+            return false;
+
+        // Skip whitespace and comments, counting lines.
+        while (pos < end)
+        {
+            if (*pos == '#')
+                while (pos < end && *pos != '\n')
+                    pos++;
+            else if (*pos == '\n')
+                line++, pos++;
+            else if (std::isspace(static_cast<unsigned char>(*pos)))
+                pos++;
+            else
+                break;
+        }
+        if (pos == end)
+            return false;
+
+        auto start = pos;
+        if (*pos == '{' || *pos == '}')
+            pos++;
+        else if (*pos == '"')
+        {
+            // A quoted string; the token is what is between the quotes.
+            start = ++pos;
+            while (pos < end && *pos != '"' && *pos != '\n')
+                pos++;
+            if (pos == end || *pos != '"')
+                return error("unterminated string");
+            token = std::string_view(start, static_cast<size_t>(pos - start));
+            pos++;
+            return true;
+        }
+        else
+            while (pos < end && !std::isspace(static_cast<unsigned char>(*pos)) && *pos != '{' && *pos != '}' &&
+                   *pos != '#')
+                pos++;
+
+        token = std::string_view(start, static_cast<size_t>(pos - start));
+        return true;
+    }
+
+    bool expect(std::string_view expected)
+    {
+        std::string_view token;
+        if (!next(token) || token != expected)
+            return error("expected '" + std::string(expected) + "'");
+        return true;
+    }
+
+    static bool to_number(std::string_view token, double &value)
+    {
+        auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+        return result.ec == std::errc() && result.ptr == token.data() + token.size();
+    }
+
+    static bool is_name(std::string_view token)
+    {
+        // Anything but a number, a brace or a word of the format.
+        static const std::string_view keywords[] = {
+            "camera", "texture", "material", "object", "solid", "checker", "image", "noise", "lambertian",
+            "metal", "dielectric", "diffuse_light", "isotropic", "sphere", "moving_sphere", "quad", "box",
+            "constant_medium", "translate", "rotate_y", "group", "bvh"};
+        double value;
+        if (token.empty() || token == "{" || token == "}" || to_number(token, value))
+            return false;
+        for (auto keyword : keywords)
+            if (token == keyword)
+                return false;
+        return true;
+    }
+
+    bool peek_number()
+    {
+        // Whether the next token is a number, without consuming it.
+        auto saved_pos = pos;
+        auto saved_line = line;
+        std::string_view token;
+        double value;
+        bool number = next(token) && to_number(token, value);
+        pos = saved_pos;
+        line = saved_line;
+        return number;
+    }
+
+    bool number(double &value)
+    {
+        std::string_view token;
+        if (!next(token))
+            return error("expected a number, found the end of the file");
+        if (!to_number(token, value))
+            return error("expected a number, found '" + std::string(token) + "'");
+        return true;
+    }
+
+    bool triple(vec3 &v)
+    {
+        double x, y, z;
+        if (!number(x) || !number(y) || !number(z))
+            return false;
+        v = vec3(x, y, z);
+        return true;
+    }
+
+    // Definition keys hold the exact bits of each parameter (and the addresses of shared
+    // parts), so only truly identical definitions share an object.
+    static std::string key_of(double value) { return std::string(reinterpret_cast<const char *>(&value), sizeof(value)); }
+
+    static std::string key_of(const vec3 &v) { return key_of(v.x) + key_of(v.y) + key_of(v.z); }
+
+    static std::string key_of(const void *object)
+    {
+        return std::string(reinterpret_cast<const char *>(&object), sizeof(object));
+    }
+
+    template <typename T, typename Make>
+    static shared_ptr<T> shared(std::unordered_map<std::string, shared_ptr<T>> &made, const std::string &key,
+                                Make make)
+    {
+        // The existing object with this definition, or a new one.
+        auto &slot = made[key];
+        if (!slot)
+            slot = make();
+        return slot;
+    }
+
+    bool parse_camera(camera &cam)
+    {
+        if (!expect("{"))
+            return false;
+
+        std::string_view key;
+        while (next(key) && key != "}")
+        {
+            double value = 0;
+            bool ok;
+            if (key == "aspect")
+            {
+                // A ratio may be written as a fraction, 16/9.
+                std::string_view token;
+                ok = next(token);
+                auto slash = token.find('/');
+                double denominator = 1;
+                if (ok)
+                    ok = (slash == std::string_view::npos)
+                             ? to_number(token, value)
+                             : to_number(token.substr(0, slash), value) &&
+                                   to_number(token.substr(slash + 1), denominator) && denominator != 0;
+                if (!ok)
+                    return error("expected an aspect ratio, found '" + std::string(token) + "'");
+                cam.aspect_ratio = value / denominator;
+            }
+            else if (key == "width" || key == "spp" || key == "depth")
+            {
+                if (!number(value))
+                    return false;
+                ok = true;
+                if (value < 1 || value != std::floor(value))
+                    return error("'" + std::string(key) + "' must be a positive whole number");
+                (key == "width" ? cam.image_width : key == "spp" ? cam.samples_per_pixel : cam.max_depth) =
+                    static_cast<int>(value);
+            }
+            else if (key == "vfov")
+                ok = number(cam.vfov);
+            else if (key == "defocus_angle")
+                ok = number(cam.defocus_angle);
+            else if (key == "focus_dist")
+                ok = number(cam.focus_dist);
+            else if (key == "lookfrom")
+                ok = triple(cam.lookfrom);
+            else if (key == "lookat")
+                ok = triple(cam.lookat);
+            else if (key == "vup")
+                ok = triple(cam.vup);
+            else if (key == "background")
+                ok = triple(cam.background);
+            else if (key == "environment")
+            {
+                std::string_view filename;
+                if (!next(filename))
+                    return error("expected an environment map file name");
+                double intensity = 1;
+                auto name = std::string(filename);
+                ok = !peek_number() || number(intensity);
+                cam.environment = make_shared<environment_light>(name.c_str(), static_cast<float>(intensity));
+            }
+            else
+                return error("unknown camera setting '" + std::string(key) + "'");
+
+            if (!ok)
+                return false;
+        }
+
+        if (failed)
+            return false;
+        if (key != "}")
+            return error("expected '}' to close the camera");
+        return true;
+    }
+
+    shared_ptr<texture> parse_texture()
+    {
+        std::string_view token;
+        if (!next(token))
+            return fail("expected a texture");
+
+        double value;
+        if (token == "solid" || to_number(token, value))
+        {
+            // A bare color is shorthand for a solid one.
+            vec3 c;
+            if (token == "solid")
+            {
+                if (!triple(c))
+                    return nullptr;
+            }
+            else
+            {
+                double g, b;
+                if (!number(g) || !number(b))
+                    return nullptr;
+                c = vec3(value, g, b);
+            }
+            return shared(textures, "solid" + key_of(c), [&] { return make_shared<solid_color>(c); });
+        }
+        if (token == "checker")
+        {
+            double scale;
+            if (!number(scale))
+                return nullptr;
+            auto even = parse_texture();
+            auto odd = even ? parse_texture() : nullptr;
+            if (!odd)
+                return nullptr;
+            return shared(textures, "checker" + key_of(scale) + key_of(even.get()) + key_of(odd.get()),
+                          [&] { return make_shared<checker_texture>(scale, even, odd); });
+        }
+        if (token == "image")
+        {
+            std::string_view filename;
+            if (!next(filename))
+                return fail("expected an image file name");
+            auto name = std::string(filename);
+            return shared(textures, "image" + name, [&] { return make_shared<image_texture>(name.c_str()); });
+        }
+        if (token == "noise")
+        {
+            double scale;
+            if (!number(scale))
+                return nullptr;
+            return shared(textures, "noise" + key_of(scale), [&] { return make_shared<noise_texture>(scale); });
+        }
+
+        auto it = named_textures.find(std::string(token));
+        if (it == named_textures.end())
+            return fail("unknown texture '" + std::string(token) + "'");
+        return it->second;
+    }
+
+    shared_ptr<material> parse_material()
+    {
+        std::string_view token;
+        if (!next(token))
+            return fail("expected a material");
+
+        if (token == "lambertian" || token == "diffuse_light" || token == "isotropic")
+        {
+            auto tex = parse_texture();
+            if (!tex)
+                return nullptr;
+            auto key = std::string(token) + key_of(tex.get());
+            if (token == "lambertian")
+                return shared(materials, key, [&] { return make_shared<lambertian>(tex); });
+            if (token == "diffuse_light")
+                return shared(materials, key, [&] { return make_shared<diffuse_light>(tex); });
+            return shared(materials, key, [&] { return make_shared<isotropic>(tex); });
+        }
+        if (token == "metal")
+        {
+            vec3 albedo;
+            double fuzz;
+            if (!triple(albedo) || !number(fuzz))
+                return nullptr;
+            return shared(materials, "metal" + key_of(albedo) + key_of(fuzz),
+                          [&] { return make_shared<metal>(albedo, fuzz); });
+        }
+        if (token == "dielectric")
+        {
+            double index;
+            if (!number(index))
+                return nullptr;
+            return shared(materials, "dielectric" + key_of(index), [&] { return make_shared<dielectric>(index); });
+        }
+
+        auto it = named_materials.find(std::string(token));
+        if (it == named_materials.end())
+            return fail("unknown material '" + std::string(token) + "'");
+        return it->second;
+    }
+
+    shared_ptr<hittable> parse_object()
+    {
+        std::string_view token;
+        if (!next(token))
+            return fail("expected an object");
+        return parse_object(token);
+    }
+
+    shared_ptr<hittable> parse_object(std::string_view token)
+    {
+        if (token == "sphere" || token == "moving_sphere")
+        {
+            vec3 center1, center2;
+            double radius;
+            if (!triple(center1) || (token == "moving_sphere" && !triple(center2)) || !number(radius))
+                return nullptr;
+            auto mat = parse_material();
+            if (!mat)
+                return nullptr;
+            if (token == "sphere")
+                return make_shared<sphere>(center1, radius, mat);
+            return make_shared<sphere>(center1, center2, radius, mat);
+        }
+        if (token == "quad" || token == "box")
+        {
+            vec3 a, b, c;
+            if (!triple(a) || !triple(b) || (token == "quad" && !triple(c)))
+                return nullptr;
+            auto mat = parse_material();
+            if (!mat)
+                return nullptr;
+            if (token == "quad")
+                return make_shared<quad>(a, b, c, mat);
+            return box(a, b, mat);
+        }
+        if (token == "constant_medium")
+        {
+            double density;
+            if (!number(density))
+                return nullptr;
+            if (density <= 0)
+                return fail("a medium's density must be positive");
+            auto albedo = parse_texture();
+            auto boundary = albedo ? parse_object() : nullptr;
+            if (!boundary)
+                return nullptr;
+            return make_shared<constant_medium>(boundary, density, albedo);
+        }
+        if (token == "translate")
+        {
+            vec3 offset;
+            if (!triple(offset))
+                return nullptr;
+            auto object = parse_object();
+            return object ? make_shared<translate>(object, offset) : nullptr;
+        }
+        if (token == "rotate_y")
+        {
+            double angle;
+            if (!number(angle))
+                return nullptr;
+            auto object = parse_object();
+            return object ? make_shared<rotate_y>(object, angle) : nullptr;
+        }
+        if (token == "group" || token == "bvh")
+        {
+            if (!expect("{"))
+                return nullptr;
+            auto group = make_shared<hittable_list>();
+            std::string_view member;
+            while (next(member) && member != "}")
+            {
+                auto object = parse_object(member);
+                if (!object)
+                    return nullptr;
+                group->add(object);
+            }
+            if (failed)
+                return nullptr;
+            if (member != "}")
+                return fail("expected '}' to close the " + std::string(token));
+            if (token == "group" || group->objects.empty())
+                return group;
+            return make_shared<bvh_node>(*group);
+        }
+
+        auto it = named_objects.find(std::string(token));
+        if (it == named_objects.end())
+            return fail("unknown object '" + std::string(token) + "'");
+        return it->second;
+    }
+};
+
+// Loads a scene file into s. False, with a message on std::cerr, if it cannot be read or
+// parsed; s is then left as it was.
+inline bool load_scene(const std::string &filename, scene &s)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+        return false;
+    }
+    std::string text;
+    in.seekg(0, std::ios::end);
+    text.resize(static_cast<size_t>(std::max<std::streamoff>(0, in.tellg())));
+    in.seekg(0, std::ios::beg);
+    in.read(&text[0], static_cast<std::streamsize>(text.size()));
+
+    scene loaded;
+    {
+        scoped_phase timer(render_phase::scene_build);
+        if (!scene_parser().parse(text, filename, loaded))
+            return false;
+    }
+    s = loaded;
+    return true;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hittable.h"
+#include "material.h"
 #include "vec.h"
 
 class sphere : public hittable
@@ -8,26 +9,45 @@ class sphere : public hittable
 public:
     // Stationary Sphere
     sphere(point3 _center, double _radius, shared_ptr<material> _material)
-        : center1(_center), radius(_radius), mat(_material), is_moving(false)
+        : radius(_radius), mat(_material)
     {
-        auto rvec = vec3(radius, radius, radius);
-        box = aabb(center1 - rvec, center1 + rvec);
+        set_center(_center);
     }
 
     // Moving Sphere
     sphere(point3 _center1, point3 _center2, double _radius, shared_ptr<material> _material)
-        : center1(_center1), radius(_radius), mat(_material), is_moving(true)
+        : radius(_radius), mat(_material)
+    {
+        set_center(_center1, _center2);
+    }
+
+    // Repositioning a sphere updates its own box only; call refit() (or bvh_node::update())
+    // on whatever contains it before rendering again.
+    void set_center(point3 _center)
+    {
+        center1 = _center;
+        center_vec = vec3(0, 0, 0);
+        is_moving = false;
+
+        auto rvec = vec3(radius, radius, radius);
+        box = aabb(center1 - rvec, center1 + rvec);
+    }
+
+    void set_center(point3 _center1, point3 _center2)
     {
+        center1 = _center1;
+        center_vec = _center2 - _center1;
+        is_moving = true;
+
         auto rvec = vec3(radius, radius, radius);
         aabb box1(_center1 - rvec, _center1 + rvec);
         aabb box2(_center2 - rvec, _center2 + rvec);
         box = aabb(box1, box2);
-
-        center_vec = _center2 - _center1;
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
+        count_stat(&render_counters::sphere_tests);
         point3 center = is_moving ? sphere_center(r.time()) : center1;
         vec3 oc = r.origin() - center;
         auto a = r.direction().length_squared();
@@ -53,11 +73,89 @@ public:
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
+        if (r.has_differentials())
+            set_sphere_uv_footprint(r, outward_normal, rec);
+        else
+            rec.du = rec.dv = 0;
         rec.mat = mat;
+        rec.primitive_id = id;
         return true;
     }
+    bool hit_interval(const ray &r, interval &crossings) const override
+    {
+        // Both roots of the same quadratic hit() solves.
+        count_stat(&render_counters::sphere_tests);
+        point3 center = is_moving ? sphere_center(r.time()) : center1;
+        vec3 oc = r.origin() - center;
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = half_b * half_b - a * c;
+        if (discriminant < 0)
+            return false;
+        auto sqrtd = sqrt(discriminant);
+
+        crossings = interval(crossings, interval((-half_b - sqrtd) / a, (-half_b + sqrtd) / a));
+        return true;
+    }
+
     aabb bounding_box() const override { return box; }
 
+    void collect_emitters(std::vector<const hittable *> &emitters) const override
+    {
+        if (mat && mat->is_emitter())
+            emitters.push_back(this);
+    }
+
+    vec3 random(const point3 &origin, const sample2d &s, double time) const override
+    {
+        // From outside, a uniform direction in the cone the sphere subtends; from inside, any
+        // direction reaches it.
+        auto direction = (is_moving ? sphere_center(time) : center1) - origin;
+        auto distance_squared = direction.length_squared();
+        if (distance_squared <= radius * radius)
+            return uniform_sphere(s);
+
+        auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+        auto z = 1 + s.v * (cos_theta_max - 1);
+        auto phi = 2 * pi * s.u;
+        auto sin_theta = sqrt(fmax(0.0, 1 - z * z));
+        return onb(direction.normalized()).local(vec3(cos(phi) * sin_theta, sin(phi) * sin_theta, z));
+    }
+
+    double pdf_value(const point3 &origin, const vec3 &direction, double time) const override
+    {
+        hit_record rec;
+        if (!this->hit(ray(origin, direction, time), interval(0.001, infinity), rec))
+            return 0;
+
+        auto distance_squared = ((is_moving ? sphere_center(time) : center1) - origin).length_squared();
+        if (distance_squared <= radius * radius)
+            return uniform_sphere_pdf();
+
+        auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+        return 1 / (2 * pi * (1 - cos_theta_max));
+    }
+
+    double emitted_power() const override
+    {
+        // The color at one point stands for the whole surface.
+        if (!mat)
+            return 0;
+        return 4 * pi * pi * radius * radius * luminance(mat->emitted(0.5, 0.5, center1));
+    }
+
+    aabb bounding_box_at(double time) const override
+    {
+        if (!is_moving)
+            return box;
+
+        auto rvec = vec3(radius, radius, radius);
+        auto center = sphere_center(time);
+        return aabb(center - rvec, center + rvec);
+    }
+
 private:
     point3 center1;
     double radius;
@@ -73,6 +171,19 @@ private:
         return center1 + time * center_vec;
     }
 
+    void set_sphere_uv_footprint(const ray &r, const point3 &p, hit_record &rec) const
+    {
+        // Surface derivatives of the (u,v) mapping below at the unit-sphere point p. The
+        // v-direction is undefined at the poles, where any vector of the right length will do.
+        vec3 dpdu = (2 * pi * radius) * vec3(p.z, 0, -p.x);
+        auto s = sqrt(p.x * p.x + p.z * p.z);
+        vec3 dpdv = (s > 1e-6) ? (pi * radius / s) * vec3(-p.x * p.y, s * s, -p.y * p.z)
+                               : vec3(pi * radius, 0, 0);
+        if (dpdu.near_zero())
+            dpdu = vec3(0, 0, 2 * pi * radius * 1e-6);
+        rec.set_uv_footprint(r, dpdu, dpdv);
+    }
+
     static void get_sphere_uv(const point3 &p, double &u, double &v)
     {
         auto theta = acos(-p.y);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+
+// Render cost counters. They are only compiled in when RTW_STATS is defined (CMake option
+// RAYTRACING_STATS); otherwise every count_stat() call compiles to nothing.
+#ifdef RTW_STATS
+constexpr bool stats_enabled = true;
+#else
+constexpr bool stats_enabled = false;
+#endif
+
+struct render_counters
+{
+    std::uint64_t rays = 0;         // Rays traced against the world
+    std::uint64_t bvh_nodes = 0;    // BVH nodes visited
+    std::uint64_t box_tests = 0;    // Ray-box tests (aabb::hit)
+    std::uint64_t sphere_tests = 0; // Ray-sphere intersection tests
+    std::uint64_t quad_tests = 0;   // Ray-quad intersection tests
+    std::uint64_t bounces = 0;      // Scattering events along camera paths
+
+    std::uint64_t primitive_tests() const { return sphere_tests + quad_tests; }
+
+    render_counters &operator+=(const render_counters &other)
+    {
+        rays += other.rays;
+        bvh_nodes += other.bvh_nodes;
+        box_tests += other.box_tests;
+        sphere_tests += other.sphere_tests;
+        quad_tests += other.quad_tests;
+        bounces += other.bounces;
+        return *this;
+    }
+
+    render_counters operator-(const render_counters &other) const
+    {
+        render_counters diff;
+        diff.rays = rays - other.rays;
+        diff.bvh_nodes = bvh_nodes - other.bvh_nodes;
+        diff.box_tests = box_tests - other.box_tests;
+        diff.sphere_tests = sphere_tests - other.sphere_tests;
+        diff.quad_tests = quad_tests - other.quad_tests;
+        diff.bounces = bounces - other.bounces;
+        return diff;
+    }
+
+    void report(std::ostream &out, double seconds, std::uint64_t camera_rays) const
+    {
+        // Summary of one render: throughput, work per ray, and how long the average camera
+        // path is (in rays traced and in scattering events).
+        auto per = [](std::uint64_t count, std::uint64_t total)
+        { return (total > 0) ? static_cast<double>(count) / total : 0.0; };
+
+        out << "Rays: " << rays << " in " << seconds << " s ("
+            << ((seconds > 0) ? rays / seconds / 1e6 : 0.0) << " Mrays/s)\n"
+            << "Tests per ray: " << per(box_tests, rays) << " boxes (" << per(bvh_nodes, rays)
+            << " BVH nodes), " << per(sphere_tests, rays) << " spheres, " << per(quad_tests, rays)
+            << " quads\n"
+            << "Average path length: " << per(rays, camera_rays) << " rays, " << per(bounces, camera_rays)
+            << " scatter events\n";
+    }
+};
+
+inline render_counters &thread_counters()
+{
+    // Each thread counts into its own copy, so counting never contends.
+    thread_local render_counters counters;
+    return counters;
+}
+
+inline void count_stat(std::uint64_t render_counters::*counter)
+{
+    if constexpr (stats_enabled)
+        ++(thread_counters().*counter);
+}
@@ -2,16 +2,28 @@
 
 #include "rtweekend.h"
 
+#include "aabb.h"
+#include "parallel.h"
 #include "rtw_std_image.h"
+#include "texture_cache.h"
 
 #include "perlin.h"
 
+#include <vector>
+
 class texture
 {
 public:
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3 &p) const = 0;
+
+    // du and dv are the widths in u and v that one sample covers; textures that can
+    // pre-filter use them, the rest ignore them.
+    virtual color value(double u, double v, const point3 &p, double du, double dv) const
+    {
+        return value(u, v, p);
+    }
 };
 
 class solid_color : public texture
@@ -44,6 +56,11 @@ public:
     }
 
     color value(double u, double v, const point3 &p) const override
+    {
+        return value(u, v, p, 0, 0);
+    }
+
+    color value(double u, double v, const point3 &p, double du, double dv) const override
     {
         auto xInteger = static_cast<int>(std::floor(inv_scale * p.x));
         auto yInteger = static_cast<int>(std::floor(inv_scale * p.y));
@@ -51,7 +68,7 @@ public:
 
         bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
 
-        return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+        return isEven ? even->value(u, v, p, du, dv) : odd->value(u, v, p, du, dv);
     }
 
 private:
@@ -63,28 +80,29 @@ private:
 class image_texture : public texture
 {
 public:
-    image_texture(const char *filename) : image(filename) {}
+    // The MIP pyramid is built once at load time; the decoded image itself is not kept.
+    image_texture(const char *filename) : mip(texture_cache::global().get(filename)) {}
 
     color value(double u, double v, const point3 &p) const override
+    {
+        return value(u, v, p, 0, 0);
+    }
+
+    color value(double u, double v, const point3 &p, double du, double dv) const override
     {
         // If we have no texture data, then return solid cyan as a debugging aid.
-        if (image.height() <= 0)
+        if (mip->height() <= 0)
             return color(0, 1, 1);
 
         // Clamp input texture coordinates to [0,1] x [1,0]
         u = interval(0, 1).clamp(u);
         v = 1.0 - interval(0, 1).clamp(v); // Flip V to image coordinates
 
-        auto i = static_cast<int>(u * image.width());
-        auto j = static_cast<int>(v * image.height());
-        auto pixel = image.pixel_data(i, j);
-
-        auto color_scale = 1.0 / 255.0;
-        return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+        return mip->lookup(u, v, du, dv);
     }
 
 private:
-    rtw_image image;
+    shared_ptr<const mipmap> mip;
 };
 
 class noise_texture : public texture
@@ -97,10 +115,70 @@ public:
     color value(double u, double v, const point3 &p) const override
     {
         auto s = scale * p;
-        return color(1, 1, 1) * 0.5 * (1 + sin(s.z + 10 * noise.turb(s)));
+        return color(1, 1, 1) * 0.5 * (1 + sin(s.z + 10 * turbulence(s)));
+    }
+
+    void bake(aabb bounds, int resolution = 128)
+    {
+        // For static scenes: samples the turbulence once on a resolution^3 grid spanning bounds
+        // (world space), after which lookups inside bounds interpolate the grid instead of
+        // evaluating seven noise octaves. Detail finer than a grid cell is smoothed away, so
+        // choose the resolution from the texture scale and the size of the object.
+        if (resolution < 2)
+            return;
+        bounds = bounds.pad();
+        baked_min = scale * point3(bounds.x.min, bounds.y.min, bounds.z.min);
+        baked_step = (scale / (resolution - 1)) * vec3(bounds.x.size(), bounds.y.size(), bounds.z.size());
+        baked_res = resolution;
+        baked.assign(static_cast<size_t>(resolution) * resolution * resolution, 0.0f);
+
+        parallel_for(0, resolution, 1, [&](size_t z0, size_t z1)
+                     {
+            std::vector<point3> row(resolution);
+            std::vector<double> turb(resolution);
+            for (auto k = z0; k < z1; k++)
+                for (int j = 0; j < resolution; j++)
+                {
+                    for (int i = 0; i < resolution; i++)
+                        row[i] = baked_min + vec3(i * baked_step.x, j * baked_step.y, k * baked_step.z);
+                    noise.turb(row.data(), turb.data(), row.size());
+                    for (int i = 0; i < resolution; i++)
+                        baked[(k * resolution + j) * resolution + i] = static_cast<float>(turb[i]);
+                } });
     }
 
 private:
     perlin noise;
     double scale;
+    std::vector<float> baked; // 烘焙的湍流网格（x 方向最快），为空表示未烘焙
+    point3 baked_min;         // 网格原点（噪声空间）
+    vec3 baked_step;          // 网格单元尺寸（噪声空间）
+    int baked_res = 0;        // 每个轴上的网格点数
+
+    double turbulence(const point3 &s) const
+    {
+        if (baked_res > 0)
+        {
+            auto gx = (s.x - baked_min.x) / baked_step.x;
+            auto gy = (s.y - baked_min.y) / baked_step.y;
+            auto gz = (s.z - baked_min.z) / baked_step.z;
+            auto last = static_cast<double>(baked_res - 1);
+            if (gx >= 0 && gy >= 0 && gz >= 0 && gx <= last && gy <= last && gz <= last)
+            {
+                // Trilinear interpolation of the eight surrounding grid samples.
+                auto i = std::min(static_cast<int>(gx), baked_res - 2);
+                auto j = std::min(static_cast<int>(gy), baked_res - 2);
+                auto k = std::min(static_cast<int>(gz), baked_res - 2);
+                auto fx = gx - i, fy = gy - j, fz = gz - k;
+                auto cell = &baked[(static_cast<size_t>(k) * baked_res + j) * baked_res + i];
+                auto row = static_cast<size_t>(baked_res);
+                auto slice = row * baked_res;
+                auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+                auto y0 = lerp(lerp(cell[0], cell[1], fx), lerp(cell[row], cell[row + 1], fx), fy);
+                auto y1 = lerp(lerp(cell[slice], cell[slice + 1], fx), lerp(cell[slice + row], cell[slice + row + 1], fx), fy);
+                return lerp(y0, y1, fz);
+            }
+        }
+        return noise.turb(s);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "rtweekend.h"
+
+#include "mipmap.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class texture_cache
+{
+public:
+    // Process-wide cache of decoded, tiled image textures keyed by file name, so every
+    // image_texture that names the same file shares a single copy of its texels.
+    static texture_cache &global()
+    {
+        static texture_cache cache;
+        return cache;
+    }
+
+    shared_ptr<const mipmap> get(const std::string &filename)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(filename);
+        if (it != entries.end())
+            return it->second;
+
+        auto texture = make_shared<const mipmap>(filename);
+        entries.emplace(filename, texture);
+        return texture;
+    }
+
+    // Drops the cache's own references; textures still used by a scene stay alive.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+    size_t size() const { return entries.size(); }
+
+    // Memory budget for resident texture tiles across all cached textures (0 is unlimited).
+    void set_memory_budget(size_t bytes) { texture_tile_pool::global().set_budget(bytes); }
+    size_t resident_bytes() const { return texture_tile_pool::global().resident_bytes(); }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, shared_ptr<const mipmap>> entries;
+
+    // The tile pool must outlive the cached textures, which return their tiles to it when
+    // destroyed, so construct it first (statics are destroyed in reverse order).
+    texture_cache() { texture_tile_pool::global(); }
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Wall-clock time spent in each phase of producing an image, summed over the process.
+enum class render_phase
+{
+    scene_build,
+    bvh_build,
+    texture_load,
+    render,
+    denoise,
+    output,
+    count
+};
+
+inline const char *phase_name(render_phase phase)
+{
+    static const char *names[] = {"Scene build", "BVH build", "Texture load", "Render", "Denoise", "Output"};
+    return names[static_cast<size_t>(phase)];
+}
+
+class render_timings
+{
+public:
+    static render_timings &global()
+    {
+        static render_timings timings;
+        return timings;
+    }
+
+    void add(render_phase phase, std::chrono::steady_clock::duration elapsed)
+    {
+        totals[static_cast<size_t>(phase)] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+    double seconds(render_phase phase) const
+    {
+        return totals[static_cast<size_t>(phase)].load() * 1e-9;
+    }
+
+    void clear()
+    {
+        for (auto &total : totals)
+            total = 0;
+    }
+
+    void report(std::ostream &out) const
+    {
+        double sum = 0;
+        for (size_t p = 0; p < totals.size(); p++)
+            sum += seconds(static_cast<render_phase>(p));
+
+        out << "Time by phase:\n";
+        for (size_t p = 0; p < totals.size(); p++)
+        {
+            auto s = seconds(static_cast<render_phase>(p));
+            out << "  " << std::left << std::setw(14) << phase_name(static_cast<render_phase>(p)) << std::right << std::fixed << std::setprecision(3)
+                << std::setw(10) << s << " s" << std::setprecision(1) << std::setw(7)
+                << ((sum > 0) ? 100 * s / sum : 0.0) << "%\n";
+        }
+        out << "  " << std::left << std::setw(14) << "Total" << std::right << std::setprecision(3) << std::setw(10)
+            << sum << " s\n";
+        out << std::defaultfloat << std::setprecision(6);
+    }
+
+private:
+    std::array<std::atomic<std::int64_t>, static_cast<size_t>(render_phase::count)> totals{};
+};
+
+class trace_recorder
+{
+public:
+    // Collects timed events and writes them as a Chrome JSON trace, which chrome://tracing and
+    // ui.perfetto.dev open directly. Recording is off unless enable() is called or the
+    // RTW_TRACE environment variable names the output file.
+    static trace_recorder &global()
+    {
+        static trace_recorder recorder;
+        return recorder;
+    }
+
+    ~trace_recorder()
+    {
+        if (is_enabled() && !saved)
+            save();
+    }
+
+    void enable(const std::string &filename)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        output_filename = filename;
+        saved = false;
+        enabled.store(!filename.empty(), std::memory_order_relaxed);
+    }
+
+    bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    void record(const std::string &name, const char *category, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end, const std::string &args = std::string())
+    {
+        // One complete ("X") event on the calling thread's track. args, if given, is the body
+        // of a JSON object shown with the event, e.g. "\"x\": 32, \"y\": 64".
+        if (!is_enabled())
+            return;
+
+        event e{name, category, microseconds(start), microseconds(end) - microseconds(start), thread_index(), args};
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(std::move(e));
+    }
+
+    bool save()
+    {
+        // Writes every event recorded so far. Returns false if the file could not be written.
+        std::lock_guard<std::mutex> lock(mutex);
+        saved = true;
+        if (output_filename.empty())
+            return false;
+
+        std::ofstream out(output_filename);
+        if (!out)
+        {
+            std::cerr << "ERROR: Could not write trace file '" << output_filename << "'.\n";
+            return false;
+        }
+
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        std::vector<bool> named;
+        for (const auto &e : events)
+        {
+            if (e.thread >= named.size())
+                named.resize(e.thread + 1, false);
+            if (!named[e.thread])
+            {
+                named[e.thread] = true;
+                out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << e.thread
+                    << ", \"args\": {\"name\": \"" << "thread " << e.thread
+                    << "\"}},\n";
+            }
+        }
+        for (size_t n = 0; n < events.size(); n++)
+        {
+            const auto &e = events[n];
+            out << "{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"ts\": "
+                << std::fixed << std::setprecision(3) << e.start << ", \"dur\": " << e.duration
+                << std::defaultfloat << ", \"pid\": 1, \"tid\": " << e.thread;
+            if (!e.args.empty())
+                out << ", \"args\": {" << e.args << "}";
+            out << ((n + 1 < events.size()) ? "},\n" : "}\n");
+        }
+        out << "]}\n";
+
+        std::clog << "Trace written to " << output_filename << " (" << events.size() << " events)\n";
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct event
+    {
+        std::string name;
+        const char *category;
+        double start;    // Microseconds since the recorder was created
+        double duration; // Microseconds
+        size_t thread;   // Track index: 0 for the first thread that records, then 1, 2, ...
+        std::string args;
+    };
+
+    std::mutex mutex;
+    std::vector<event> events;
+    std::string output_filename;
+    std::atomic<bool> enabled{false};
+    bool saved = false;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    trace_recorder()
+    {
+        if (auto filename = std::getenv("RTW_TRACE"))
+            enable(filename);
+    }
+
+    double microseconds(std::chrono::steady_clock::time_point t) const
+    {
+        return std::chrono::duration<double, std::micro>(t - epoch).count();
+    }
+
+    static size_t thread_index()
+    {
+        static std::atomic<size_t> next_index{0};
+        thread_local size_t index = next_index++;
+        return index;
+    }
+};
+
+class scoped_phase
+{
+public:
+    // Times the enclosing scope as the given phase. Phases nest per thread: while an inner
+    // phase runs, the outer one is paused, so a BVH built inside scene construction counts
+    // as BVH build only. With tracing enabled the whole scope is also recorded as an event.
+    explicit scoped_phase(render_phase phase) : phase(phase), parent(active())
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (parent)
+            parent->pause(now);
+        begun = start = now;
+        active() = this;
+    }
+
+    ~scoped_phase()
+    {
+        auto now = std::chrono::steady_clock::now();
+        render_timings::global().add(phase, now - start);
+        trace_recorder::global().record(phase_name(phase), "phase", begun, now);
+        active() = parent;
+        if (parent)
+            parent->start = now;
+    }
+
+    scoped_phase(const scoped_phase &) = delete;
+    scoped_phase &operator=(const scoped_phase &) = delete;
+
+private:
+    render_phase phase;
+    scoped_phase *parent;
+    std::chrono::steady_clock::time_point begun; // When the scope was entered
+    std::chrono::steady_clock::time_point start; // When the current unpaused stretch began
+
+    void pause(std::chrono::steady_clock::time_point now)
+    {
+        render_timings::global().add(phase, now - start);
+    }
+
+    static scoped_phase *&active()
+    {
+        thread_local scoped_phase *current = nullptr;
+        return current;
+    }
+};
+
+class progress_reporter
+{
+public:
+    // Reports a long render's progress on out at most once per interval: share done, throughput
+    // and estimated time left. advance() may be called from any thread; between reports it
+    // costs two atomic operations and never touches the stream.
+    progress_reporter(std::ostream &out, std::uint64_t total_samples, double interval_seconds)
+        : out(out), total(total_samples), interval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                std::chrono::duration<double>(interval_seconds))),
+          start(std::chrono::steady_clock::now()), next_report((start + interval).time_since_epoch().count())
+    {
+    }
+
+    void advance(std::uint64_t samples)
+    {
+        auto done = completed += samples;
+        auto now = std::chrono::steady_clock::now();
+        auto due = next_report.load(std::memory_order_relaxed);
+        if (now.time_since_epoch().count() < due)
+            return;
+
+        // Whichever thread moves the deadline on is the one that reports.
+        if (!next_report.compare_exchange_strong(due, (now + interval).time_since_epoch().count()))
+            return;
+
+        std::chrono::duration<double> elapsed = now - start;
+        auto rate = done / elapsed.count();
+        auto eta = (rate > 0) ? (total - done) / rate : 0.0;
+        out << "\rRendered " << std::fixed << std::setprecision(1) << 100.0 * done / total << "%, "
+            << std::setprecision(2) << rate / 1e6 << " M samples/s, ETA " << clock_time(eta) << "   "
+            << std::defaultfloat << std::setprecision(6) << std::flush;
+    }
+
+    void finish()
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        out << "\rDone: " << completed.load() << " samples in " << std::fixed << std::setprecision(2)
+            << elapsed.count() << " s (" << completed.load() / elapsed.count() / 1e6 << " M samples/s)        \n"
+            << std::defaultfloat << std::setprecision(6);
+    }
+
+private:
+    std::ostream &out;
+    std::uint64_t total;
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<std::uint64_t> completed{0};
+    std::atomic<std::chrono::steady_clock::rep> next_report;
+
+    static std::string clock_time(double seconds)
+    {
+        // h:mm:ss
+        auto total_seconds = static_cast<long long>(seconds + 0.5);
+        std::ostringstream s;
+        s << total_seconds / 3600 << ':' << std::setfill('0') << std::setw(2) << (total_seconds / 60) % 60 << ':'
+          << std::setw(2) << total_seconds % 60;
+        return s.str();
+    }
+};
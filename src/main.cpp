@@ -1,435 +1,301 @@
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include "rtweekend.h"
 
-#include "camera.h"
-#include "bvh.h"
-#include "sphere.h"
-#include "texture.h"
-#include "quad.h"
-#include "constant_medium.h"
+#include "animation.h"
+#include "scene_file.h"
+#include "scenes.h"
 
-void random_spheres()
-{
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+#ifndef _WIN32
+#include "distributed.h"   // POSIX sockets and fork()
+#include "render_server.h" // Unix domain sockets
+#endif
 
-    for (int a = -11; a < 11; a++)
+template <typename Build>
+void render(Build build)
+{
+    scene s;
     {
-        for (int b = -11; b < 11; b++)
-        {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9)
-            {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0, .5), 0);
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
+        scoped_phase timer(render_phase::scene_build);
+        s = build();
     }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    world = hittable_list(make_shared<bvh_node>(world));
-    std::cout << world.objects.size() << std::endl;
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0.02;
-    cam.focus_dist = 10.0;
-
-    cam.render(world);
+    s.cam.render(s.world);
 }
 
-void two_spheres()
+void bvh_build_benchmark(int sphere_count)
 {
+    // Times BVH construction over a synthetic cloud of small spheres.
     hittable_list world;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    for (int i = 0; i < sphere_count; i++)
+        world.add(make_shared<sphere>(point3::random(-1000, 1000), 1, white));
 
-    auto checker = make_shared<checker_texture>(0.8, color(.2, .3, .1), color(.9, .9, .9));
-
-    world.add(make_shared<sphere>(point3(0, -10, 0), 10, make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-void earth()
-{
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0, 0, 0), 2, earth_surface);
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(0, 0, 12);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto tree = make_shared<bvh_node>(world);
+    auto end = std::chrono::steady_clock::now();
 
-    cam.render(hittable_list(globe));
+    std::clog << "BVH build over " << sphere_count << " spheres: "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
 }
 
-void two_perlin_spheres()
+void flythrough()
 {
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+    // Orbits the random spheres scene while a glass ball bounces, reusing one BVH that is
+    // refit every frame.
+    auto world = random_spheres_world();
+    auto ball = make_shared<sphere>(point3(2, 0.5, 2), 0.5, make_shared<dielectric>(1.5));
+    world.add(ball);
+    auto tree = make_shared<bvh_node>(world);
 
     camera cam;
 
     cam.aspect_ratio = 16.0 / 9.0;
     cam.image_width = 400;
-    cam.samples_per_pixel = 100;
+    cam.samples_per_pixel = 50;
     cam.max_depth = 50;
     cam.background = color(0.70, 0.80, 1.00);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
     cam.vup = vec3(0, 1, 0);
+    cam.defocus_angle = 0.02;
 
-    cam.defocus_angle = 0;
+    camera_animation anim;
+    anim.frame_count = 48;
+    anim.output_prefix = "flythrough";
+    anim.add_keyframe({0.0, point3(13, 2, 3), point3(0, 0, 0), 20, 10.0});
+    anim.add_keyframe({1.0, point3(3, 2, 13), point3(0, 0, 0), 25, 10.0});
+    anim.add_keyframe({2.0, point3(-13, 3, 3), point3(0, 0.5, 0), 30, 12.0});
+    anim.update_scene = [&](int /*frame*/, double time)
+    {
+        auto height = 0.5 + 2 * fabs(sin(pi * time));
+        ball->set_center(point3(2, height, 2));
+        tree->update();
+    };
 
-    cam.render(world);
+    anim.render(cam, *tree);
 }
 
-void quads()
+#ifndef _WIN32
+int distributed_main(int argc, char **argv)
 {
-    hittable_list world;
-
-    // Materials
-    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
-
-    camera cam;
+    // RayTracing --coordinator <scene> [--port N] [--spawn N] [--width N] [--spp N] [--depth N]
+    //                          [--seed N] [--tile N] [--job-samples N] [--timeout S] [--threads N] [--out F]
+    // RayTracing --worker <host>:<port> [--threads N]
+    std::string mode = argv[1];
+    if ((mode != "--coordinator" && mode != "--worker") || argc < 3)
+    {
+        std::cerr << "ERROR: Expected --coordinator <scene> or --worker <host>:<port>.\n";
+        return 1;
+    }
 
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0.70, 0.80, 1.00);
+    coordinator_options options;
+    std::string target = argv[2];
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "ERROR: Missing value for '" << arg << "'.\n";
+            return 1;
+        }
 
-    cam.vfov = 80;
-    cam.lookfrom = point3(0, 0, 9);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
+        std::string value = argv[++i];
+        if (arg == "--threads")
+            options.worker_threads = std::atoi(value.c_str());
+        else if (mode == "--worker")
+        {
+            std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+            return 1;
+        }
+        else if (arg == "--port")
+            options.port = std::atoi(value.c_str());
+        else if (arg == "--spawn")
+            options.spawn = std::atoi(value.c_str());
+        else if (arg == "--width")
+            options.settings.image_width = std::atoi(value.c_str());
+        else if (arg == "--spp")
+            options.settings.samples_per_pixel = std::atoi(value.c_str());
+        else if (arg == "--depth")
+            options.settings.max_depth = std::atoi(value.c_str());
+        else if (arg == "--seed")
+            options.settings.seed = static_cast<unsigned int>(std::atoi(value.c_str()));
+        else if (arg == "--tile")
+            options.tile_size = std::atoi(value.c_str());
+        else if (arg == "--job-samples")
+            options.job_samples = std::atoi(value.c_str());
+        else if (arg == "--timeout")
+            options.timeout = std::atof(value.c_str());
+        else if (arg == "--out")
+            options.out = value;
+        else
+        {
+            std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+            return 1;
+        }
+    }
 
-    cam.defocus_angle = 0;
+    if (mode == "--worker")
+    {
+        auto colon = target.rfind(':');
+        if (colon == std::string::npos)
+        {
+            std::cerr << "ERROR: Expected <host>:<port>, got '" << target << "'.\n";
+            return 1;
+        }
+        return run_worker(target.substr(0, colon), std::atoi(target.c_str() + colon + 1), options.worker_threads);
+    }
 
-    cam.render(world);
+    options.settings.scene = target;
+    return run_coordinator(options);
 }
-
-void simple_light()
+#else
+int distributed_main(int, char **argv)
 {
-    hittable_list world;
-
-    auto pertext = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
-
-    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-    world.add(make_shared<sphere>(point3(0, 7, 0), 2, difflight));
-    world.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
-
-    camera cam;
-
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 20;
-    cam.lookfrom = point3(26, 3, 6);
-    cam.lookat = point3(0, 2, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
+    std::string mode = argv[1];
+    if (mode == "--coordinator" || mode == "--worker")
+        std::cerr << "ERROR: '" << mode << "' is not supported on this platform.\n";
+    else
+        std::cerr << "ERROR: Unknown option '" << mode << "'.\n";
+    return 1;
 }
+#endif
 
-void cornell_box()
+#ifndef _WIN32
+int server_main(int argc, char **argv)
 {
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
-
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    world.add(box2);
-
-    camera cam;
+    // RayTracing --serve <socket> [--cache N]
+    // RayTracing --submit <socket> <scene> [--width N] [--spp N] [--depth N] [--seed N] [--priority N]
+    //                     [--lookfrom x,y,z] [--lookat x,y,z] [--vfov D] [--out F]
+    // RayTracing --shutdown <socket>
+    std::string mode = argv[1];
+    if (argc < 3 || (mode == "--submit" && argc < 4))
+    {
+        std::cerr << "ERROR: Missing arguments for '" << mode << "'.\n";
+        return 1;
+    }
+    std::string socket_path = argv[2];
 
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
+    if (mode == "--shutdown")
+    {
+        auto link = connect_unix(socket_path);
+        return (link.is_open() && link.send_line("shutdown")) ? 0 : 1;
+    }
 
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
+    size_t cache_size = 4;
+    std::string out = "render.ppm";
+    std::ostringstream render_line;
+    if (mode == "--submit")
+        render_line << "render " << std::quoted(argv[3]);
+    auto request = render_line.str();
+    for (int i = (mode == "--submit") ? 4 : 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "ERROR: Missing value for '" << arg << "'.\n";
+            return 1;
+        }
 
-    cam.defocus_angle = 0;
+        std::string value = argv[++i];
+        if (mode == "--serve" && arg == "--cache")
+            cache_size = static_cast<size_t>(std::max(1, std::atoi(value.c_str())));
+        else if (mode == "--submit" && arg == "--out")
+            out = value;
+        else if (mode == "--submit" &&
+                 (arg == "--width" || arg == "--spp" || arg == "--depth" || arg == "--seed" || arg == "--priority" ||
+                  arg == "--lookfrom" || arg == "--lookat" || arg == "--vfov"))
+            request += ' ' + arg.substr(2) + '=' + value;
+        else
+        {
+            std::cerr << "ERROR: Unknown option '" << arg << "'.\n";
+            return 1;
+        }
+    }
 
-    cam.render(world);
+    if (mode == "--submit")
+        return submit_render(socket_path, request, out);
+    return render_server(socket_path, cache_size).run();
 }
-
-void cornell_smoke()
+#else
+int server_main(int, char **argv)
 {
-    hittable_list world;
-
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(make_shared<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
-    world.add(make_shared<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-
-    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1, 1, 1)));
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth = 50;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(278, 278, -800);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
+    std::cerr << "ERROR: '" << argv[1] << "' is not supported on this platform.\n";
+    return 1;
 }
+#endif
 
-void final_scene(int image_width, int samples_per_pixel, int max_depth)
+int main(int argc, char **argv)
 {
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
-
-    int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++)
+    if (argc > 1)
     {
-        for (int j = 0; j < boxes_per_side; j++)
+        std::string mode = argv[1];
+        if (mode == "--serve" || mode == "--submit" || mode == "--shutdown")
+            return server_main(argc, argv);
+        if (mode == "--scene" && argc == 3)
         {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i * w;
-            auto z0 = -1000.0 + j * w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1, 101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+            // RayTracing --scene <file>: renders a scene file to stdout.
+            scene s;
+            if (!load_scene(argv[2], s))
+                return 1;
+            s.cam.render(s.world);
+            render_timings::global().report(std::clog);
+            trace_recorder::global().save();
+            return 0;
         }
+        return distributed_main(argc, argv);
     }
 
-    hittable_list world;
-
-    world.add(make_shared<bvh_node>(boxes1));
-
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
-
-    auto center1 = point3(400, 400, 200);
-    auto center2 = center1 + vec3(30, 0, 0);
-    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
-
-    world.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)));
-
-    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70, make_shared<dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-    world.add(make_shared<constant_medium>(boundary, .0001, color(1, 1, 1)));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    world.add(make_shared<sphere>(point3(400, 200, 400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.1);
-    world.add(make_shared<sphere>(point3(220, 280, 300), 80, make_shared<lambertian>(pertext)));
-
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++)
-    {
-        boxes2.add(make_shared<sphere>(point3::random(0, 165), 10, white));
-    }
-
-    world.add(make_shared<translate>(
-        make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2), 15),
-        vec3(-100, 270, 395)));
-
-    camera cam;
-
-    cam.aspect_ratio = 1.0;
-    cam.image_width = image_width;
-    cam.samples_per_pixel = samples_per_pixel;
-    cam.max_depth = max_depth;
-    cam.background = color(0, 0, 0);
-
-    cam.vfov = 40;
-    cam.lookfrom = point3(478, 278, -600);
-    cam.lookat = point3(278, 278, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(world);
-}
-
-int main()
-{
     switch (0)
     {
     case 1:
-        random_spheres();
+        render(random_spheres);
         break;
     case 2:
-        two_spheres();
+        render(two_spheres);
         break;
     case 3:
-        earth();
+        render(earth);
         break;
     case 4:
-        two_perlin_spheres();
+        render(two_perlin_spheres);
         break;
     case 5:
-        quads();
+        render(quads);
         break;
     case 6:
-        simple_light();
+        render(simple_light);
         break;
     case 7:
-        cornell_box();
+        render(cornell_box);
         break;
     case 8:
-        cornell_smoke();
+        render(cornell_smoke);
         break;
     case 9:
-        final_scene(800, 10000, 40);
+        render([] { return final_scene(800, 10000, 40); });
+        break;
+    case 10:
+        bvh_build_benchmark(1000000);
+        break;
+    case 11:
+        flythrough();
+        break;
+    case 12:
+        render(sun_and_sky);
+        break;
+    case 13:
+        render(many_lights);
+        break;
+    case 14:
+        render([] { return cornell_cloud(); });
         break;
     default:
-        final_scene(400, 250, 4);
+        render([] { return final_scene(400, 250, 4); });
         break;
     }
+
+    render_timings::global().report(std::clog);
+    trace_recorder::global().save();
     return 0;
 }
\ No newline at end of file